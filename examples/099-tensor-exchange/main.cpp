@@ -5,6 +5,7 @@
 #include <pynncc/compute/python_nodes.h>
 
 #include <nncc/compute/algebra_ops.h>
+#include <nncc/compute/tensor_ops.h>
 #include <nncc/engine/loop.h>
 #include <nncc/engine/timer.h>
 #include <nncc/gui/picking.h>
@@ -29,7 +30,7 @@ int Loop() {
 
     // Create a thread listening to shared memory handles and a tensor registry
     bx::Thread tensor_update_listener_;
-    tensor_update_listener_.init(&python::StartSharedTensorRedisLoop, static_cast<void*>(&context.dispatcher), 0,
+    tensor_update_listener_.init(&python::StartSharedTensorRingLoop, static_cast<void*>(&context.dispatcher), 0,
                                  "tensor_updates");
     python::TensorRegistry tensors;
     tensors.Init(&context.dispatcher);
@@ -57,6 +58,21 @@ int Loop() {
         }
     );
     compute_node_editor.RegisterMenuItem(algebra);
+    auto tensor = std::make_shared<compute::ComputeEditorAddMenuItem>(
+        "Tensor",
+        nncc::vector<std::shared_ptr<compute::ComputeEditorAddMenuItem>>{
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Add", &compute::MakeTensorAddOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Subtract", &compute::MakeTensorSubOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Multiply", &compute::MakeTensorMulOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Divide", &compute::MakeTensorDivOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Clamp", &compute::MakeTensorClampOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Normalize", &compute::MakeTensorNormalizeOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("To UInt8", &compute::MakeTensorToUInt8Op),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("To Float", &compute::MakeTensorToFloatOp),
+            std::make_shared<compute::ComputeEditorAddMenuItem>("Swizzle", &compute::MakeTensorSwizzleOp),
+        }
+    );
+    compute_node_editor.RegisterMenuItem(tensor);
     auto python = std::make_shared<compute::ComputeEditorAddMenuItem>(
         "Python",
         nncc::vector<std::shared_ptr<compute::ComputeEditorAddMenuItem>>{
@@ -104,12 +120,14 @@ int Loop() {
         ImGui::Begin("Inspector");
         auto selected_nodes = compute_node_editor.GetSelectedNodes();
         if (ImGui::Button("Evaluate graph")) {
-            compute_node_editor.GetGraph().Evaluate(&context.registry);
+            compute_node_editor.GetGraph().MarkAllDirty();
+            compute_node_editor.GetGraph().EvaluateAsync(&context.registry);
         }
         for (auto node : selected_nodes) {
             if (node->render_context_ui) {
                 if (node->render_context_ui(node)) {
-                    compute_node_editor.GetGraph().Evaluate(&context.registry);
+                    node->dirty = true;
+                    compute_node_editor.GetGraph().EvaluateAsync(&context.registry);
                 }
             }
         }
@@ -156,14 +174,22 @@ int Loop() {
 
     object_picker.Destroy();
 
-    python::StopSharedTensorRedisLoop(python::kRedisQueueName);
+    python::StopSharedTensorRingLoop(python::kSharedTensorRingName);
     return 0;
 }
 
-int main() {
+int main(int argc, char** argv) {
     py::scoped_interpreter guard{};
 
     nncc::engine::ApplicationLoop loop;
     loop.connect<&Loop>();
+
+    // E.g. `099-tensor-exchange --headless frames/{:06}.png` on a render node without a display
+    if (argc > 1 && nncc::string(argv[1]) == "--headless") {
+        nncc::engine::HeadlessOptions options;
+        options.offscreen.capture_pattern = argc > 2 ? argv[2] : "";
+        options.offscreen.capture_every = 30;
+        return nncc::engine::RunHeadless(&loop, options);
+    }
     return nncc::engine::Run(&loop);
 }
\ No newline at end of file
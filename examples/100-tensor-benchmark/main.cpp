@@ -0,0 +1,376 @@
+// Streams tensors from a producer into TensorRegistry and reports how fast and how late they arrive, without a window
+// or GPU: bgfx runs the Noop renderer on this thread.
+//
+//   100-tensor-benchmark --producer cpp --shape 1024,1024,4 --dtype uint8 --tensors 2 --updates 1000
+//   100-tensor-benchmark --producer python --buffers 3 --batch 1
+//
+// Producers stamp the first 16 bytes of every tensor with the send time (steady clock, ns) and a sequence number.
+// An update is applied when the frame it is rendered in has been submitted; sequence numbers the app never saw, because
+// newer updates superseded them, count as dropped.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <unistd.h>
+
+#include <bgfx/bgfx.h>
+#include <bgfx/platform.h>
+#include <folly/String.h>
+#include <libshm/libshm.h>
+
+#include <pynncc/torch/shm_communication.h>
+#include <pynncc/torch/tensor_registry.h>
+
+#include <nncc/context/context.h>
+
+using namespace nncc;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    nncc::string producer = "cpp";
+    nncc::vector<int64_t> shape = {512, 512, 4};
+    nncc::string dtype = "uint8";
+    int tensors = 1;
+    int updates = 1000;
+    // Updates per second of each tensor, 0 for as fast as the ring takes them
+    double rate = 0;
+    // Publish the updates of all tensors as one batch
+    bool batch = false;
+    // Storages per tensor of the Python producer, see NNCCStorage
+    int buffers = 3;
+    double fps = 60;
+    // Upload budget per frame in MB
+    size_t budget = 64;
+    double idle_timeout = 2.0;
+};
+
+const std::unordered_map<nncc::string, std::pair<torch::Dtype, compute::DType>> kDtypes = {
+        {"uint8",    {torch::kUInt8,    compute::DType::UInt8}},
+        {"int32",    {torch::kInt32,    compute::DType::Int32}},
+        {"float16",  {torch::kFloat16,  compute::DType::Float16}},
+        {"bfloat16", {torch::kBFloat16, compute::DType::BFloat16}},
+        {"float32",  {torch::kFloat32,  compute::DType::Float32}},
+};
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return false;
+        }
+        const nncc::string key = argv[i], value = argv[i + 1];
+        if (key == "--producer") {
+            options->producer = value;
+        } else if (key == "--shape") {
+            options->shape.clear();
+            folly::split(",", value, options->shape);
+        } else if (key == "--dtype") {
+            options->dtype = value;
+        } else if (key == "--tensors") {
+            options->tensors = std::stoi(value.toStdString());
+        } else if (key == "--updates") {
+            options->updates = std::stoi(value.toStdString());
+        } else if (key == "--rate") {
+            options->rate = std::stod(value.toStdString());
+        } else if (key == "--batch") {
+            options->batch = value == "1";
+        } else if (key == "--buffers") {
+            options->buffers = std::stoi(value.toStdString());
+        } else if (key == "--fps") {
+            options->fps = std::stod(value.toStdString());
+        } else if (key == "--budget") {
+            options->budget = std::stoul(value.toStdString());
+        } else if (key == "--idle-timeout") {
+            options->idle_timeout = std::stod(value.toStdString());
+        } else {
+            fprintf(stderr, "Unknown option %s\n", key.c_str());
+            return false;
+        }
+    }
+    return kDtypes.contains(options->dtype) && (options->producer == "cpp" || options->producer == "python" ||
+                                                options->producer == "none");
+}
+
+nncc::string JoinShape(const nncc::vector<int64_t>& shape, const char* separator) {
+    nncc::string joined;
+    for (auto dim: shape) {
+        joined += fmt::format("{}{}", joined.empty() ? "" : separator, dim);
+    }
+    return joined;
+}
+
+int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Writes tensors into torch shared memory from this process, the way a C++ training loop would
+void RunCppProducer(const Options& options) {
+    libshm_init(NNCC_TORCH_SHM_MANAGER);
+
+    std::unique_ptr<python::SharedTensorRing> ring;
+    while (!(ring = python::SharedTensorRing::Open(python::kSharedTensorRingName))) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const auto [torch_dtype, dtype] = kDtypes.at(options.dtype);
+    size_t bytes = torch::elementSize(torch_dtype);
+    for (auto dim: options.shape) {
+        bytes *= dim;
+    }
+    if (bytes < 16) {
+        fprintf(stderr, "Tensors need room for a 16 byte stamp\n");
+        return;
+    }
+
+    nncc::vector<at::DataPtr> storages;
+    nncc::vector<python::SharedTensorDescriptor> descriptors(options.tensors);
+    for (int i = 0; i < options.tensors; ++i) {
+        const auto filename = fmt::format("/torch_{}_bench_{}", getpid(), i);
+        storages.push_back(THManagedMapAllocator::makeDataPtr(
+                "", filename.c_str(), at::ALLOCATOR_MAPPED_SHAREDMEM | at::ALLOCATOR_MAPPED_EXCLUSIVE, bytes));
+
+        auto& descriptor = descriptors[i];
+        descriptor.dtype = static_cast<uint8_t>(dtype);
+        descriptor.ndim = static_cast<uint8_t>(options.shape.size());
+        std::copy(options.shape.begin(), options.shape.end(), descriptor.dims);
+        fmt::format_to_n(descriptor.name, sizeof(descriptor.name) - 1, "bench_{}", i);
+        std::strncpy(descriptor.manager_handle, THManagedMapAllocator::fromDataPtr(storages.back())->manager_handle(),
+                     sizeof(descriptor.manager_handle));
+        std::strncpy(descriptor.filename, filename.c_str(), sizeof(descriptor.filename));
+    }
+    if (options.batch && options.tensors > 1) {
+        descriptors[0].batch_size = static_cast<uint16_t>(options.tensors);
+    }
+
+    const auto period = std::chrono::duration<double>(options.rate > 0 ? 1.0 / options.rate : 0.0);
+    auto next = Clock::now();
+    for (int64_t update = 0; update < options.updates; ++update) {
+        for (int i = 0; i < options.tensors; ++i) {
+            auto* data = static_cast<uint8_t*>(storages[i].get());
+            std::memset(data + 16, static_cast<int>(update), bytes - 16);
+            const int64_t stamp[2] = {Now(), update};
+            std::memcpy(data, stamp, sizeof(stamp));
+        }
+
+        const auto push = [&](const python::SharedTensorDescriptor* first, size_t count) {
+            while (!ring->TryPush(first, count)) {
+                if (ring->IsStopped()) {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            return true;
+        };
+        if (options.batch) {
+            if (!push(descriptors.data(), descriptors.size())) {
+                return;
+            }
+        } else {
+            for (const auto& descriptor: descriptors) {
+                if (!push(&descriptor, 1)) {
+                    return;
+                }
+            }
+        }
+
+        next += std::chrono::duration_cast<Clock::duration>(period);
+        std::this_thread::sleep_until(next);
+    }
+
+    // Keeps the storages alive until the app has read them
+    while (!ring->IsStopped()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void RunPythonProducer(const Options& options) {
+    const auto shape = JoinShape(options.shape, ",");
+    const auto command = fmt::format(
+            "PYTHONPATH={} {} {} --shape {} --dtype {} --tensors {} --updates {} --rate {} --batch {} --buffers {}",
+            NNCC_PYNNCC_PATH, NNCC_PYTHON_EXECUTABLE, NNCC_BENCHMARK_PRODUCER, shape.toStdString(),
+            options.dtype.toStdString(), options.tensors, options.updates, options.rate, options.batch ? 1 : 0,
+            options.buffers);
+    if (std::system(command.c_str()) != 0) {
+        fprintf(stderr, "Python producer failed: %s\n", command.c_str());
+    }
+}
+
+// Latencies in ms
+double Percentile(nncc::vector<double>* values, double percentile) {
+    if (values->empty()) {
+        return 0;
+    }
+    const auto index = static_cast<size_t>(percentile / 100.0 * static_cast<double>(values->size() - 1));
+    std::nth_element(values->begin(), values->begin() + static_cast<ptrdiff_t>(index), values->end());
+    return (*values)[index];
+}
+
+class Benchmark {
+public:
+    explicit Benchmark(python::TensorRegistry* tensors) : tensors_(*tensors) {}
+
+    void OnSharedTensorUpdate(const python::SharedTensorEvent& event) {
+        auto& registry = context::Context::Get()->registry;
+        if (!tensors_.Contains(event.name)) {
+            return;
+        }
+        const auto& tensor = *registry.get<python::TensorWithPointer>(tensors_.Get(event.name));
+        if (tensor.nbytes() < 2 * sizeof(int64_t)) {
+            return;
+        }
+
+        int64_t stamp[2];
+        std::memcpy(stamp, tensor.data_ptr(), sizeof(stamp));
+        auto [last, inserted] = last_sequence_.try_emplace(event.name, -1);
+        if (stamp[1] <= last->second) {
+            return;
+        }
+        dropped_ += stamp[1] - last->second - 1;
+        last->second = stamp[1];
+        bytes_ += tensor.nbytes();
+        in_frame_.push_back(stamp[0]);
+        last_update_ = Clock::now();
+    }
+
+    void OnSharedTensorBatch(const python::SharedTensorBatchEvent& event) {
+        for (const auto& update: event.updates) {
+            OnSharedTensorUpdate(update);
+        }
+    }
+
+    // Once the frame that shows the updates has been submitted
+    void OnFrame() {
+        const auto now = Now();
+        for (auto stamp: in_frame_) {
+            latencies_.push_back(static_cast<double>(now - stamp) * 1e-6);
+        }
+        in_frame_.clear();
+    }
+
+    [[nodiscard]] bool Done(const Options& options) const {
+        if (last_sequence_.size() == static_cast<size_t>(options.tensors) &&
+            std::all_of(last_sequence_.begin(), last_sequence_.end(), [&options](const auto& entry) {
+                return entry.second == options.updates - 1;
+            })) {
+            return true;
+        }
+        return latencies_.empty() ? Clock::now() - start_ > std::chrono::seconds(30)
+                                  : Clock::now() - last_update_ > std::chrono::duration<double>(options.idle_timeout);
+    }
+
+    void Report(const Options& options, size_t frames, const nncc::vector<double>& upload_ms, size_t staged_bytes,
+                size_t torn) {
+        const auto seconds = std::chrono::duration<double>(last_update_ - start_).count();
+        const auto expected = static_cast<int64_t>(options.tensors) * options.updates;
+        const auto applied = static_cast<int64_t>(latencies_.size());
+        auto uploads = upload_ms;
+
+        printf("producer=%s shape=%s dtype=%s tensors=%d updates=%d batch=%d\n", options.producer.c_str(),
+               JoinShape(options.shape, "x").c_str(), options.dtype.c_str(), options.tensors, options.updates,
+               options.batch ? 1 : 0);
+        printf("applied=%lld dropped=%lld missing=%lld\n", static_cast<long long>(applied),
+               static_cast<long long>(dropped_), static_cast<long long>(expected - applied - dropped_));
+        printf("latency_ms p50=%.3f p90=%.3f p99=%.3f max=%.3f\n", Percentile(&latencies_, 50),
+               Percentile(&latencies_, 90), Percentile(&latencies_, 99), Percentile(&latencies_, 100));
+        if (seconds > 0) {
+            printf("throughput_mb_s=%.1f updates_s=%.1f frames_s=%.1f\n",
+                   static_cast<double>(bytes_) / (1 << 20) / seconds, static_cast<double>(applied) / seconds,
+                   static_cast<double>(frames) / seconds);
+        } else {
+            printf("throughput_mb_s=n/a: no update arrived\n");
+        }
+        printf("upload_ms p50=%.3f p99=%.3f staged_mb=%.1f torn=%zu\n", Percentile(&uploads, 50),
+               Percentile(&uploads, 99), static_cast<double>(staged_bytes) / (1 << 20), torn);
+    }
+
+private:
+    python::TensorRegistry& tensors_;
+
+    std::unordered_map<nncc::string, int64_t> last_sequence_;
+    nncc::vector<int64_t> in_frame_;
+    nncc::vector<double> latencies_;
+    int64_t dropped_ = 0;
+    size_t bytes_ = 0;
+    Clock::time_point start_ = Clock::now(), last_update_ = start_;
+};
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        fprintf(stderr, "Usage: %s [--producer cpp|python|none] [--shape 512,512,4] [--dtype uint8] [--tensors 1] "
+                        "[--updates 1000] [--rate 0] [--batch 0] [--buffers 3] [--fps 60] [--budget 64]\n", argv[0]);
+        return 1;
+    }
+
+    auto& context = *context::Context::Get();
+
+    // Rendering on this thread
+    bgfx::renderFrame();
+    if (context.rendering.Init(1280, 720, bgfx::RendererType::Noop) != 0) {
+        return 1;
+    }
+
+    bx::Thread tensor_update_listener;
+    tensor_update_listener.init(&python::StartSharedTensorRingLoop, static_cast<void*>(&context.dispatcher), 0,
+                                "tensor_updates");
+    python::TensorRegistry tensors;
+    tensors.Init(&context.dispatcher);
+    tensors.Uploader().SetFrameBudget(options.budget << 20);
+
+    Benchmark benchmark(&tensors);
+    context.dispatcher.sink<python::SharedTensorEvent>().connect<&Benchmark::OnSharedTensorUpdate>(benchmark);
+    context.dispatcher.sink<python::SharedTensorBatchEvent>().connect<&Benchmark::OnSharedTensorBatch>(benchmark);
+
+    std::thread producer;
+    if (options.producer == "cpp") {
+        producer = std::thread(&RunCppProducer, options);
+    } else if (options.producer == "python") {
+        producer = std::thread(&RunPythonProducer, options);
+    }
+
+    math::Transform identity = math::Transform::Identity();
+    nncc::vector<double> upload_ms;
+    size_t frames = 0, staged_bytes = 0, torn = 0;
+    const auto frame_time = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / options.fps));
+    auto next_frame = Clock::now();
+    while (!benchmark.Done(options)) {
+        context.dispatcher.update();
+
+        const auto upload_start = Clock::now();
+        tensors.Update();
+        upload_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - upload_start).count());
+        staged_bytes += tensors.Uploader().GetStats().staged_bytes;
+        torn += tensors.Uploader().GetStats().torn;
+
+        bgfx::touch(0);
+        context.rendering.Update(context, identity, identity, 1280, 720);
+        context.frame_number = bgfx::frame();
+        benchmark.OnFrame();
+        ++frames;
+
+        next_frame += frame_time;
+        std::this_thread::sleep_until(next_frame);
+    }
+
+    benchmark.Report(options, frames, upload_ms, staged_bytes, torn);
+
+    python::StopSharedTensorRingLoop(python::kSharedTensorRingName);
+    tensor_update_listener.shutdown();
+    if (producer.joinable()) {
+        producer.join();
+    }
+
+    tensors.Clear();
+    context.rendering.Destroy();
+    bgfx::shutdown();
+    return 0;
+}
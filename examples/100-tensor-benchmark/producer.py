@@ -0,0 +1,67 @@
+"""Python producer of 100-tensor-benchmark: shares tensors through NNCCStorage as a training script would.
+
+Stamps the first 16 bytes of every tensor with the send time and a sequence number, see main.cpp.
+"""
+
+import argparse
+import time
+
+import torch
+
+import pynncc
+
+DTYPES = {
+    "uint8": torch.uint8,
+    "int32": torch.int32,
+    "float16": torch.float16,
+    "bfloat16": torch.bfloat16,
+    "float32": torch.float32,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--shape", default="512,512,4")
+    parser.add_argument("--dtype", default="uint8", choices=DTYPES)
+    parser.add_argument("--tensors", type=int, default=1)
+    parser.add_argument("--updates", type=int, default=1000)
+    parser.add_argument("--rate", type=float, default=0, help="updates per second of each tensor, 0 for unlimited")
+    parser.add_argument("--batch", type=int, default=0)
+    parser.add_argument("--buffers", type=int, default=3)
+    args = parser.parse_args()
+
+    shape = [int(dim) for dim in args.shape.split(",")]
+    tensors = [torch.zeros(shape, dtype=DTYPES[args.dtype]) for _ in range(args.tensors)]
+
+    storage = None
+    while storage is None:
+        try:
+            storage = pynncc.NNCCStorage(buffers=args.buffers)
+        except FileNotFoundError:
+            time.sleep(0.01)
+
+    period = 1.0 / args.rate if args.rate > 0 else 0.0
+    next_update = time.monotonic()
+    for update in range(args.updates):
+        for tensor in tensors:
+            raw = tensor.view(-1).view(torch.uint8)
+            raw[16:] = update % 256
+            raw[:16] = torch.tensor([time.monotonic_ns(), update], dtype=torch.int64).view(torch.uint8)
+
+        named = {f"bench_{index}": tensor for index, tensor in enumerate(tensors)}
+        if args.batch:
+            storage.submit_tensors(named)
+        else:
+            for name, tensor in named.items():
+                storage.submit_tensor(name, tensor)
+
+        next_update += period
+        time.sleep(max(0.0, next_update - time.monotonic()))
+
+    # The app maps the shared storages until it is done
+    while not storage.ring.stopped:
+        time.sleep(0.01)
+
+
+if __name__ == "__main__":
+    main()
@@ -3,6 +3,9 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
 namespace nncc::common {
 
 Image LoadImage(const nncc::string& filename) {
@@ -11,4 +14,9 @@ Image LoadImage(const nncc::string& filename) {
     return {image, width, height, channels};
 }
 
-}
\ No newline at end of file
+bool SaveImage(const nncc::string& filename, const Image& image) {
+    return stbi_write_png(filename.c_str(), image.width, image.height, image.channels, image.buffer.data(),
+                          image.width * image.channels) != 0;
+}
+
+}
@@ -27,5 +27,8 @@ struct Image {
 
 Image LoadImage(const nncc::string& filename);
 
+// Writes the image as a PNG, rows from top to bottom
+bool SaveImage(const nncc::string& filename, const Image& image);
+
 }
 
@@ -22,10 +22,18 @@ const char* ConstOpState::options[] = {"Float", "String"};
 auto ConstOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
     auto& state = *node->StateAs<ConstOpState>();
     auto& context = *context::Context::Get();
-    node->outputs_by_name.at("value").value = state.value;
+    std::visit([node](const auto& value) { node->outputs[0].value = value; }, state.value);
     return Result{0, ""};
 }
 
+uint64_t ConstOpHashFn(const ComputeNode* node) {
+    const auto& state = *std::static_pointer_cast<ConstOpState>(node->state);
+    if (auto* number = std::get_if<float>(&state.value)) {
+        return std::hash<float>{}(*number);
+    }
+    return std::hash<nncc::string>{}(std::get<nncc::string>(state.value)) + 1;
+}
+
 auto ConstOpRenderFn(ComputeNode* node) {
     auto& state = *node->StateAs<ConstOpState>();
     state.edited = false;
@@ -43,11 +51,11 @@ auto ConstOpRenderFn(ComputeNode* node) {
     }
 
     if (state.type == ConstOpState::Type::Float) {
-        node->outputs_by_name.at("value").type = AttributeType::Float;
+        node->outputs[0].type = AttributeType::Float;
     } else if (state.type == ConstOpState::Type::String) {
-        node->outputs_by_name.at("value").type = AttributeType::String;
+        node->outputs[0].type = AttributeType::String;
     } else {
-        node->outputs_by_name.at("value").type = AttributeType::UserDefined;
+        node->outputs[0].type = AttributeType::UserDefined;
     }
 
     if (state.type == ConstOpState::Type::Float) {
@@ -74,11 +82,14 @@ ComputeNode MakeConstOp(const void*) {
 
     node.name = "Const";
     node.type = "Const";
+    node.affinity = ThreadAffinity::Main;
 
     node.AddOutput(Attribute("value", AttributeType::Float));
 
     node.evaluate.connect<&ConstOpEvaluateFn>();
     node.render_context_ui.connect<&ConstOpRenderFn>();
+    node.hash_state.connect<&ConstOpHashFn>();
+    node.pure = true;
 
     node.state = std::make_shared<ConstOpState>();
 
@@ -86,16 +97,16 @@ ComputeNode MakeConstOp(const void*) {
 }
 
 auto AddOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
-    auto a = node->inputs_by_name.at("a").value;
-    auto b = node->inputs_by_name.at("b").value;
+    const auto& a = node->inputs[0].value;
+    const auto& b = node->inputs[1].value;
 
-    node->outputs_by_name.at("result").value = std::get<float>(a) + std::get<float>(b);
+    node->outputs[0].value = std::get<float>(a) + std::get<float>(b);
 
     return Result{0, ""};
 }
 
 auto AddOpRenderFn(ComputeNode* node) {
-    ImGui::InputFloat("result", &std::get<float>(node->outputs_by_name.at("result").value), 0.0f, 0.0f, "%0.2f",
+    ImGui::InputFloat("result", &std::get<float>(node->outputs[0].value), 0.0f, 0.0f, "%0.2f",
                       ImGuiInputTextFlags_ReadOnly);
     return false;
 }
@@ -113,21 +124,22 @@ ComputeNode MakeAddOp(const void*) {
 
     node.evaluate.connect<&AddOpEvaluateFn>();
     node.render_context_ui.connect<&AddOpRenderFn>();
+    node.pure = true;
 
     return node;
 }
 
 auto MulOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
-    auto a = node->inputs_by_name.at("a").value;
-    auto b = node->inputs_by_name.at("b").value;
+    const auto& a = node->inputs[0].value;
+    const auto& b = node->inputs[1].value;
 
-    node->outputs_by_name.at("result").value = std::get<float>(a) * std::get<float>(b);
+    node->outputs[0].value = std::get<float>(a) * std::get<float>(b);
 
     return Result{0, ""};
 }
 
 auto MulOpRenderFn(ComputeNode* node) {
-    ImGui::InputFloat("result", &std::get<float>(node->outputs_by_name.at("result").value), 0.0f, 0.0f, "%0.2f",
+    ImGui::InputFloat("result", &std::get<float>(node->outputs[0].value), 0.0f, 0.0f, "%0.2f",
                       ImGuiInputTextFlags_ReadOnly);
     return false;
 }
@@ -145,6 +157,7 @@ ComputeNode MakeMulOp(const void*) {
 
     node.evaluate.connect<&MulOpEvaluateFn>();
     node.render_context_ui.connect<&MulOpRenderFn>();
+    node.pure = true;
 
     return node;
 }
@@ -0,0 +1,121 @@
+#include "cache.h"
+
+#include <bit>
+#include <functional>
+
+namespace nncc::compute {
+
+namespace {
+
+uint64_t Combine(uint64_t seed, uint64_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+}
+
+EvaluationCache::EvaluationCache(size_t max_entries, size_t max_bytes)
+        : max_entries_(max_entries), max_bytes_(max_bytes) {}
+
+EvaluationCache::Key EvaluationCache::MakeKey(const ComputeNode& node) {
+    Key key;
+    key.node_id = node.id;
+    key.fingerprint.reserve(2 * node.inputs.size() + 1);
+    if (node.hash_state) {
+        key.fingerprint.push_back(node.hash_state(&node));
+    }
+
+    for (const auto& input: node.inputs) {
+        key.fingerprint.push_back(input.value.index());
+        if (auto* number = std::get_if<float>(&input.value)) {
+            key.fingerprint.push_back(std::bit_cast<uint32_t>(*number));
+        } else if (auto* text = std::get_if<nncc::string>(&input.value)) {
+            key.fingerprint.push_back(std::hash<nncc::string>{}(*text));
+        } else if (auto* tensor = std::get_if<TensorView>(&input.value)) {
+            // The version identifies the evaluation that produced the tensor, the pointer tells an empty one apart
+            key.fingerprint.push_back(input.version);
+            key.fingerprint.push_back(reinterpret_cast<uintptr_t>(tensor->data));
+        }
+    }
+
+    key.hash = std::hash<int>{}(node.id);
+    for (const auto& value: key.fingerprint) {
+        key.hash = Combine(key.hash, value);
+    }
+    return key;
+}
+
+bool EvaluationCache::Restore(const Key& key, ComputeNode* node) {
+    std::lock_guard lock(mutex_);
+    auto found = index_.find(key.hash);
+    if (found == index_.end() || !(found->second->key == key) ||
+        found->second->outputs.size() != node->outputs.size()) {
+        return false;
+    }
+
+    entries_.splice(entries_.begin(), entries_, found->second);
+    const auto& outputs = found->second->outputs;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        node->outputs[i].value = outputs[i].value;
+        node->outputs[i].entity = outputs[i].entity;
+        node->outputs[i].version = outputs[i].version;
+    }
+    return true;
+}
+
+void EvaluationCache::Store(Key key, const ComputeNode& node) {
+    Entry entry;
+    entry.outputs.reserve(node.outputs.size());
+    for (const auto& output: node.outputs) {
+        entry.outputs.push_back({output.value, output.entity, output.version});
+        if (auto* tensor = std::get_if<TensorView>(&output.value)) {
+            entry.bytes += tensor->Bytes();
+        }
+    }
+    entry.key = std::move(key);
+
+    std::lock_guard lock(mutex_);
+    if (entry.bytes > max_bytes_) {
+        return;
+    }
+
+    if (auto found = index_.find(entry.key.hash); found != index_.end()) {
+        bytes_ -= found->second->bytes;
+        entries_.erase(found->second);
+        index_.erase(found);
+    }
+
+    bytes_ += entry.bytes;
+    entries_.push_front(std::move(entry));
+    index_[entries_.front().key.hash] = entries_.begin();
+    Evict();
+}
+
+void EvaluationCache::SetLimits(size_t max_entries, size_t max_bytes) {
+    std::lock_guard lock(mutex_);
+    max_entries_ = max_entries;
+    max_bytes_ = max_bytes;
+    Evict();
+}
+
+void EvaluationCache::Clear() {
+    std::lock_guard lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+size_t EvaluationCache::Bytes() const {
+    std::lock_guard lock(mutex_);
+    return bytes_;
+}
+
+void EvaluationCache::Evict() {
+    while (!entries_.empty() && (entries_.size() > max_entries_ || bytes_ > max_bytes_)) {
+        const auto& last = entries_.back();
+        bytes_ -= last.bytes;
+        index_.erase(last.key.hash);
+        entries_.pop_back();
+    }
+}
+
+}
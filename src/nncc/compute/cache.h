@@ -0,0 +1,59 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <nncc/compute/graph.h>
+
+namespace nncc::compute {
+
+// Memoized outputs of pure nodes. Entries are keyed on the node and a fingerprint of its inputs: float and string
+// values by content, tensors by the version they were fed with and their storage, plus the node's state hash.
+// Least recently used entries are dropped to stay within both an entry and a byte limit; cached tensors keep their
+// buffers alive, so the byte limit caps memory held by the cache. Thread-safe.
+class EvaluationCache {
+public:
+    using Key = CacheKey;
+
+    explicit EvaluationCache(size_t max_entries = 1024, size_t max_bytes = size_t(64) << 20);
+
+    // Reads the node's state through `hash_state`, so it must be called where the node may be evaluated
+    static Key MakeKey(const ComputeNode& node);
+
+    // Copies cached outputs into the node, including their versions, so that consumers see unchanged outputs
+    bool Restore(const Key& key, ComputeNode* node);
+
+    void Store(Key key, const ComputeNode& node);
+
+    void SetLimits(size_t max_entries, size_t max_bytes);
+
+    void Clear();
+
+    [[nodiscard]] size_t Bytes() const;
+
+private:
+    struct Output {
+        std::variant<float, nncc::string, TensorView> value;
+        entt::entity entity;
+        uint64_t version;
+    };
+
+    struct Entry {
+        Key key;
+        nncc::vector<Output> outputs;
+        size_t bytes = 0;
+    };
+
+    void Evict();
+
+    mutable std::mutex mutex_;
+    size_t max_entries_, max_bytes_;
+    size_t bytes_ = 0;
+
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+};
+
+}
@@ -0,0 +1,73 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace nncc::compute {
+
+folly::CPUThreadPoolExecutor* GetComputeExecutor() {
+    static folly::CPUThreadPoolExecutor executor(std::max(1u, std::thread::hardware_concurrency()));
+    return &executor;
+}
+
+namespace {
+
+struct ParallelForState {
+    std::function<void(size_t, size_t)> fn;
+    size_t count = 0, chunk_size = 0, chunk_count = 0;
+
+    std::atomic<size_t> next_chunk = 0;
+    size_t finished_chunks = 0;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    void Work() {
+        size_t done = 0;
+        for (auto chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+            fn(chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+            ++done;
+        }
+        if (done == 0) {
+            return;
+        }
+
+        std::lock_guard lock(mutex);
+        finished_chunks += done;
+        if (finished_chunks == chunk_count) {
+            finished.notify_all();
+        }
+    }
+};
+
+}
+
+void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    auto* executor = GetComputeExecutor();
+    const size_t workers = std::max<size_t>(1, executor->numThreads());
+    const size_t chunk_count = std::min(workers, (count + grain - 1) / std::max<size_t>(1, grain));
+    if (chunk_count <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Tasks that only start after all chunks are done must find a valid state, hence the shared ownership
+    auto state = std::make_shared<ParallelForState>();
+    state->fn = fn;
+    state->count = count;
+    state->chunk_count = chunk_count;
+    state->chunk_size = (count + chunk_count - 1) / chunk_count;
+
+    for (size_t i = 1; i < chunk_count; ++i) {
+        executor->add([state]() { state->Work(); });
+    }
+    state->Work();
+
+    std::unique_lock lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->finished_chunks == state->chunk_count; });
+}
+
+}
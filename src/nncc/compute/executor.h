@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include <folly/executors/CPUThreadPoolExecutor.h>
+
+namespace nncc::compute {
+
+// Worker pool shared by graph evaluation and data-parallel node kernels, one thread per hardware thread
+folly::CPUThreadPoolExecutor* GetComputeExecutor();
+
+// Calls fn(begin, end) for chunks of at least `grain` elements covering [0, count), on the compute executor and the
+// calling thread. The caller only waits for chunks, never for pool tasks, so it is safe to call from a node that is
+// itself running on the compute executor.
+void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+}
@@ -1,8 +1,597 @@
 #include "graph.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include <folly/futures/Future.h>
+
+#include <nncc/compute/cache.h>
+
 namespace nncc::compute {
 
 int Attribute::id_counter = 0;
 int ComputeNode::id_counter = 0;
+std::atomic<uint64_t> ComputeGraph::version_counter_ = 0;
+
+struct ComputeGraph::AsyncEvaluation {
+    ComputeGraph graph;
+    nncc::vector<int> dirty_nodes;
+
+    // Only set when the graph goes away, requests made meanwhile wait for the evaluation to finish instead
+    std::atomic<bool> cancelled = false;
+    std::atomic<bool> finished = false;
+};
+
+namespace {
+
+// Steps of a level shared by pool tasks and the thread evaluating the level, which takes steps itself rather than
+// waiting for tasks that may not have started: the evaluation runs on the same pool.
+struct LevelWork {
+    std::function<void(size_t)> evaluate;
+    size_t count = 0;
+
+    std::atomic<size_t> next = 0;
+    size_t finished = 0;
+    std::mutex mutex;
+    std::condition_variable all_finished;
+
+    void Work() {
+        size_t done = 0;
+        for (auto i = next++; i < count; i = next++) {
+            evaluate(i);
+            ++done;
+        }
+        if (done == 0) {
+            return;
+        }
+
+        std::lock_guard lock(mutex);
+        finished += done;
+        if (finished == count) {
+            all_finished.notify_all();
+        }
+    }
+};
+
+}
+
+ComputeGraph::ComputeGraph() : cache_(std::make_shared<EvaluationCache>()) {}
+
+ComputeGraph::~ComputeGraph() {
+    if (!evaluation_) {
+        return;
+    }
+
+    // The evaluation may be waiting for ThreadAffinity::Main nodes, keep running them until it notices the cancellation
+    evaluation_->cancelled = true;
+    while (!evaluation_->finished) {
+        main_thread_tasks_.run();
+        std::this_thread::yield();
+    }
+}
+
+ComputeGraph::Vertex ComputeGraph::AddNode(const ComputeNode& node) {
+    InvalidateTopology();
+    return boost::add_vertex(node, graph);
+}
+
+ComputeGraph::Edge ComputeGraph::AddEdge(Vertex from, Vertex to, const ComputeEdge& edge) {
+    InvalidateTopology();
+
+    // The source keeps its outputs: the target will pull them on the next evaluation since its input version differs
+    graph[to].dirty = true;
+    return boost::add_edge(from, to, edge, graph).first;
+}
+
+void ComputeGraph::RemoveEdge(Edge edge) {
+    InvalidateTopology();
+    graph[boost::target(edge, graph)].dirty = true;
+    boost::remove_edge(edge, graph);
+}
+
+void ComputeGraph::RemoveNode(Vertex vertex) {
+    InvalidateTopology();
+    for (auto [current, end] = boost::adjacent_vertices(vertex, graph); current != end; ++current) {
+        graph[*current].dirty = true;
+    }
+    boost::clear_vertex(vertex, graph);
+    boost::remove_vertex(vertex, graph);
+}
+
+void ComputeGraph::MarkDirty(Vertex vertex) {
+    graph[vertex].dirty = true;
+}
+
+void ComputeGraph::MarkAllDirty() {
+    for (auto [current, end] = boost::vertices(graph); current != end; ++current) {
+        graph[*current].dirty = true;
+    }
+}
+
+void ComputeGraph::InvalidateTopology() {
+    plan_valid_ = false;
+}
+
+void ComputeGraph::SetExecutor(folly::Executor* executor) {
+    executor_ = executor;
+}
+
+const ExecutionPlan& ComputeGraph::Compile() {
+    if (plan_valid_) {
+        return plan_;
+    }
+
+    const auto vertex_count = boost::num_vertices(graph);
+    nncc::vector<Vertex> order;
+    order.reserve(vertex_count);
+    boost::topological_sort(graph, std::back_inserter(order));
+    std::reverse(order.begin(), order.end());
+
+    // A node's level is one past the deepest of its predecessors, so nodes of one level are independent
+    nncc::vector<uint32_t> depth(vertex_count, 0);
+    uint32_t level_count = 0;
+    for (const auto& vertex: order) {
+        for (auto [current, end] = boost::in_edges(vertex, graph); current != end; ++current) {
+            depth[vertex] = std::max(depth[vertex], depth[boost::source(*current, graph)] + 1);
+        }
+        level_count = std::max(level_count, depth[vertex] + 1);
+    }
+    std::stable_sort(order.begin(), order.end(), [&depth](Vertex a, Vertex b) {
+        return depth[a] < depth[b];
+    });
+
+    plan_ = ExecutionPlan{};
+    plan_.steps.reserve(vertex_count);
+    plan_.levels.assign(level_count + 1, 0);
+    plan_.links.reserve(boost::num_edges(graph));
+    plan_.consumers.reserve(boost::num_edges(graph));
+
+    nncc::vector<uint32_t> step_of_vertex(vertex_count, 0);
+    for (const auto& vertex: order) {
+        step_of_vertex[vertex] = static_cast<uint32_t>(plan_.steps.size());
+        ++plan_.levels[depth[vertex] + 1];
+
+        graph[vertex].arena = arena_.get();
+        profiler_->SetNodeName(graph[vertex].id, graph[vertex].name);
+
+        ExecutionPlan::Step step{vertex, &graph[vertex]};
+        step.links_begin = static_cast<uint32_t>(plan_.links.size());
+        for (auto [current, end] = boost::in_edges(vertex, graph); current != end; ++current) {
+            const auto& edge = graph[*current];
+            const auto& source = graph[boost::source(*current, graph)];
+            plan_.links.push_back({&source.outputs[edge.from_output], edge.to_input});
+        }
+        step.links_end = static_cast<uint32_t>(plan_.links.size());
+        plan_.steps.push_back(step);
+    }
+    for (uint32_t level = 0; level < level_count; ++level) {
+        plan_.levels[level + 1] += plan_.levels[level];
+    }
+
+    for (auto& step: plan_.steps) {
+        step.consumers_begin = static_cast<uint32_t>(plan_.consumers.size());
+        for (auto [current, end] = boost::adjacent_vertices(step.vertex, graph); current != end; ++current) {
+            plan_.consumers.push_back(step_of_vertex[*current]);
+        }
+        step.consumers_end = static_cast<uint32_t>(plan_.consumers.size());
+    }
+
+    FuseElementwiseChains();
+
+    plan_valid_ = true;
+    return plan_;
+}
+
+void ComputeGraph::FuseElementwiseChains() {
+    constexpr auto kNoStep = std::numeric_limits<uint32_t>::max();
+    auto& steps = plan_.steps;
+
+    // next[i] is the step that step i can be fused into: its only consumer, reading output 0 through input 0
+    nncc::vector<uint32_t> next(steps.size(), kNoStep), previous(steps.size(), kNoStep);
+    for (uint32_t i = 0; i < steps.size(); ++i) {
+        const auto& step = steps[i];
+        if (!step.node->fuse || step.node->outputs.size() != 1 || step.consumers_end - step.consumers_begin != 1) {
+            continue;
+        }
+
+        auto consumer = plan_.consumers[step.consumers_begin];
+        const auto& consumer_step = steps[consumer];
+        if (consumer_step.node->fuse != step.node->fuse) {
+            continue;
+        }
+        // The output must feed input 0 of the consumer and nothing else, since fused intermediates are not stored
+        size_t links_from_step = 0;
+        bool feeds_first_input = false;
+        for (auto l = consumer_step.links_begin; l < consumer_step.links_end; ++l) {
+            if (plan_.links[l].source == &step.node->outputs[0]) {
+                ++links_from_step;
+                feeds_first_input = feeds_first_input || plan_.links[l].input == 0;
+            }
+        }
+        if (links_from_step == 1 && feeds_first_input) {
+            next[i] = consumer;
+            previous[consumer] = i;
+        }
+    }
+
+    for (uint32_t head = 0; head < steps.size(); ++head) {
+        if (previous[head] != kNoStep || next[head] == kNoStep) {
+            continue;
+        }
+
+        auto chain_begin = static_cast<uint32_t>(plan_.chains.size());
+        auto tail = head;
+        for (auto i = head; i != kNoStep; i = next[i]) {
+            plan_.chains.push_back(i);
+            plan_.chain_nodes.push_back(steps[i].node);
+            steps[i].absorbed = true;
+            tail = i;
+        }
+
+        steps[tail].absorbed = false;
+        steps[tail].chain_begin = chain_begin;
+        steps[tail].chain_end = static_cast<uint32_t>(plan_.chains.size());
+    }
+}
+
+void ComputeGraph::PullInputs(const ExecutionPlan::Step& step) {
+    for (auto i = step.links_begin; i < step.links_end; ++i) {
+        const auto& link = plan_.links[i];
+        auto& input = step.node->inputs[link.input];
+        if (input.version != link.source->version) {
+            input.Feed(*link.source);
+        }
+    }
+}
+
+void ComputeGraph::ReleaseOutputs(const ExecutionPlan::Step& step, uint32_t owner) {
+    // The tensors the step is about to replace are taken from its outputs and from the inputs downstream they were
+    // fed into, and set aside until the step is done. Those consumers are at later levels and get the new outputs, so
+    // once the step succeeds no one reads the old buffers again and they return to the arena, to be picked up by the
+    // next evaluation. A step that fails gets them back, see RestoreReleased.
+    auto& outputs = step.node->outputs;
+    auto is_output = [&outputs](const Attribute* attribute) {
+        return attribute >= outputs.data() && attribute < outputs.data() + outputs.size();
+    };
+    auto release = [this, owner](Attribute* attribute) {
+        released_.push_back({owner, attribute, std::move(std::get<TensorView>(attribute->value)), attribute->version});
+        attribute->value = TensorView{};
+    };
+
+    for (auto& output: outputs) {
+        if (std::holds_alternative<TensorView>(output.value)) {
+            release(&output);
+        }
+    }
+    for (auto c = step.consumers_begin; c < step.consumers_end; ++c) {
+        const auto& consumer = plan_.steps[plan_.consumers[c]];
+        for (auto l = consumer.links_begin; l < consumer.links_end; ++l) {
+            auto& input = consumer.node->inputs[plan_.links[l].input];
+            if (is_output(plan_.links[l].source) && std::holds_alternative<TensorView>(input.value)) {
+                release(&input);
+                input.version = 0;
+            }
+        }
+    }
+}
+
+void ComputeGraph::RestoreReleased(const nncc::vector<uint32_t>& failed) {
+    for (auto& released: released_) {
+        if (std::find(failed.begin(), failed.end(), released.step) != failed.end()) {
+            released.attribute->value = std::move(released.value);
+            released.attribute->version = released.version;
+        }
+    }
+    released_.clear();
+}
+
+namespace {
+
+Result EvaluateNode(ComputeNode* node, entt::registry* registry) {
+    node->status->store(EvaluationStatus::Running);
+
+    Result result;
+    try {
+        result = node->evaluate(node, registry);
+    } catch (const std::exception& e) {
+        result = Result{1, e.what()};
+    }
+
+    node->status->store(result.code == 0 ? EvaluationStatus::Done : EvaluationStatus::Failed);
+    return result;
+}
+
+}
+
+Result ComputeGraph::EvaluateStep(const ExecutionPlan::Step& step, entt::registry* registry) const {
+    NodeSample sample;
+    sample.node_id = step.node->id;
+    sample.thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    sample.begin = profiler_->Now();
+
+    // The key is taken once, before the evaluation, on the thread the node is evaluated on. The state it hashes may be
+    // edited by the UI as soon as the evaluation is over.
+    std::optional<EvaluationCache::Key> key;
+    if (step.chain_begin == step.chain_end && step.node->pure && !step.absorbed) {
+        key = EvaluationCache::MakeKey(*step.node);
+    }
+
+    Result result;
+    if (key.has_value() && cache_->Restore(*key, step.node)) {
+        step.node->status->store(EvaluationStatus::Done);
+        result = Result{0, "", true};
+    } else if (step.chain_begin == step.chain_end) {
+        result = EvaluateNode(step.node, registry);
+        result.cache_key = std::move(key);
+    } else {
+        auto* chain = plan_.chain_nodes.data() + step.chain_begin;
+        const auto length = step.chain_end - step.chain_begin;
+        for (size_t i = 0; i < length; ++i) {
+            chain[i]->status->store(EvaluationStatus::Running);
+        }
+
+        try {
+            result = chain[0]->fuse(chain, length, registry);
+        } catch (const std::exception& e) {
+            result = Result{1, e.what()};
+        }
+
+        for (size_t i = 0; i < length; ++i) {
+            chain[i]->status->store(result.code == 0 ? EvaluationStatus::Done : EvaluationStatus::Failed);
+        }
+        sample.fused = length;
+    }
+
+    sample.end = profiler_->Now();
+    sample.code = result.code;
+    for (const auto& output: step.node->outputs) {
+        if (auto* tensor = std::get_if<TensorView>(&output.value)) {
+            sample.bytes += tensor->Bytes();
+        }
+    }
+    profiler_->Record(sample);
+    return result;
+}
+
+void ComputeGraph::FinishNode(const ExecutionPlan::Step& step, const Result& result) {
+    auto& node = *step.node;
+    if (result.code != 0) {
+        // Leave the node dirty so that it is retried, but do not propagate a failed evaluation downstream
+        return;
+    }
+
+    node.dirty = false;
+    if (!result.cached) {
+        for (auto& output: node.outputs) {
+            output.version = ++version_counter_;
+        }
+        // Stored once the outputs have their versions, which are restored along with them
+        if (result.cache_key.has_value()) {
+            cache_->Store(*result.cache_key, node);
+        }
+    }
+    for (auto i = step.consumers_begin; i < step.consumers_end; ++i) {
+        plan_.steps[plan_.consumers[i]].node->dirty = true;
+    }
+}
+
+void ComputeGraph::FinishStep(const ExecutionPlan::Step& step, const Result& result) {
+    if (step.chain_begin == step.chain_end) {
+        FinishNode(step, result);
+        return;
+    }
+    for (auto i = step.chain_begin; i < step.chain_end; ++i) {
+        FinishNode(plan_.steps[plan_.chains[i]], result);
+    }
+}
+
+void ComputeGraph::EvaluateLevel(uint32_t level, entt::registry* registry) {
+    scheduled_.clear();
+    for (auto i = plan_.levels[level]; i < plan_.levels[level + 1]; ++i) {
+        const auto& step = plan_.steps[i];
+        if (step.absorbed) {
+            continue;
+        }
+
+        // A fused chain runs at the level of its last step, by then the inputs of all its steps are available
+        bool dirty = step.node->dirty;
+        for (auto c = step.chain_begin; c < step.chain_end; ++c) {
+            dirty = dirty || plan_.chain_nodes[c]->dirty;
+        }
+        if (!dirty) {
+            continue;
+        }
+
+        PullInputs(step);
+        ReleaseOutputs(step, i);
+        for (auto c = step.chain_begin; c < step.chain_end; ++c) {
+            PullInputs(plan_.steps[plan_.chains[c]]);
+            ReleaseOutputs(plan_.steps[plan_.chains[c]], i);
+        }
+        scheduled_.push_back(i);
+    }
+
+    nncc::vector<uint32_t> failed;
+    auto finish = [this, &failed](uint32_t i, const Result& result) {
+        FinishStep(plan_.steps[i], result);
+        if (result.code != 0) {
+            failed.push_back(i);
+        }
+    };
+
+    // Workers only touch their own nodes: inputs were pulled above, versions and dirty flags are updated afterwards
+    nncc::vector<uint32_t> on_main, shared;
+    for (const auto& i: scheduled_) {
+        if (plan_.steps[i].node->affinity != ThreadAffinity::Main) {
+            shared.push_back(i);
+        } else if (main_executor_ != nullptr) {
+            on_main.push_back(i);
+        } else {
+            // Evaluate runs on the main thread already
+            finish(i, EvaluateStep(plan_.steps[i], registry));
+        }
+    }
+
+    std::vector<folly::Future<Result>> futures;
+    for (const auto& i: on_main) {
+        const auto* step = &plan_.steps[i];
+        futures.push_back(folly::via(folly::getKeepAliveToken(main_executor_), [this, step, registry]() {
+            return EvaluateStep(*step, registry);
+        }));
+    }
+
+    // Tasks that only start after all steps are done must find a valid state, hence the shared ownership
+    nncc::vector<Result> results(shared.size());
+    auto work = std::make_shared<LevelWork>();
+    work->count = shared.size();
+    work->evaluate = [this, &shared, &results, registry](size_t i) {
+        results[i] = EvaluateStep(plan_.steps[shared[i]], registry);
+    };
+    if (executor_ != nullptr) {
+        for (size_t i = 1; i < shared.size(); ++i) {
+            executor_->add([work]() { work->Work(); });
+        }
+    }
+    work->Work();
+    {
+        std::unique_lock lock(work->mutex);
+        work->all_finished.wait(lock, [&work]() { return work->finished == work->count; });
+    }
+    for (size_t i = 0; i < shared.size(); ++i) {
+        finish(shared[i], results[i]);
+    }
+
+    if (!futures.empty()) {
+        auto main_results = folly::collectAll(futures).get();
+        for (size_t i = 0; i < on_main.size(); ++i) {
+            finish(on_main[i], main_results[i].hasValue() ? main_results[i].value() : Result{1, "Evaluation failed."});
+        }
+    }
+
+    RestoreReleased(failed);
+}
+
+void ComputeGraph::Evaluate(entt::registry* registry) {
+    Compile();
+
+    for (uint32_t level = 0; level + 1 < plan_.levels.size(); ++level) {
+        EvaluateLevel(level, registry);
+    }
+    arena_->Collect();
+}
+
+void ComputeGraph::EvaluateAsync(entt::registry* registry) {
+    pending_registry_ = registry;
+    pending_ = true;
+
+    // The evaluation in flight runs to completion, Update starts the pending one after it
+    if (evaluation_) {
+        return;
+    }
+    Update();
+}
+
+bool ComputeGraph::IsEvaluating() const {
+    return evaluation_ != nullptr;
+}
+
+void ComputeGraph::Update() {
+    main_thread_tasks_.run();
+
+    if (evaluation_ && evaluation_->finished) {
+        ApplyAsyncEvaluation(evaluation_.get());
+        evaluation_.reset();
+    }
+
+    if (!evaluation_ && pending_) {
+        pending_ = false;
+        StartAsyncEvaluation();
+    }
+}
+
+void ComputeGraph::StartAsyncEvaluation() {
+    evaluation_ = std::make_unique<AsyncEvaluation>();
+    auto& snapshot = evaluation_->graph;
+    snapshot.graph = graph;
+    snapshot.executor_ = executor_;
+    snapshot.main_executor_ = &main_thread_tasks_;
+    snapshot.arena_ = arena_;
+    snapshot.profiler_ = profiler_;
+    snapshot.cache_ = cache_;
+    snapshot.Compile();
+
+    // The snapshot owns the dirty flags now: anything marked dirty from here on is a newer edit
+    for (auto [current, end] = boost::vertices(graph); current != end; ++current) {
+        if (graph[*current].dirty) {
+            evaluation_->dirty_nodes.push_back(graph[*current].id);
+            graph[*current].dirty = false;
+        }
+    }
+
+    const auto& plan = snapshot.plan_;
+    nncc::vector<uint8_t> pending(plan.steps.size(), 0);
+    for (size_t i = 0; i < plan.steps.size(); ++i) {
+        if (!pending[i] && !plan.steps[i].node->dirty) {
+            continue;
+        }
+        plan.steps[i].node->status->store(EvaluationStatus::Pending);
+        for (auto c = plan.steps[i].consumers_begin; c < plan.steps[i].consumers_end; ++c) {
+            pending[plan.consumers[c]] = 1;
+        }
+    }
+
+    // The shared pool, even for a graph evaluated serially: EvaluateLevel never blocks it on tasks of its own
+    auto* executor = executor_ != nullptr ? executor_ : GetComputeExecutor();
+    executor->add([evaluation = evaluation_.get(), registry = pending_registry_]() {
+        auto& snapshot = evaluation->graph;
+        for (uint32_t level = 0; level + 1 < snapshot.plan_.levels.size(); ++level) {
+            if (evaluation->cancelled) {
+                break;
+            }
+            snapshot.EvaluateLevel(level, registry);
+        }
+        snapshot.arena_->Collect();
+
+        for (auto [current, end] = boost::vertices(snapshot.graph); current != end; ++current) {
+            auto expected = EvaluationStatus::Pending;
+            snapshot.graph[*current].status->compare_exchange_strong(expected, EvaluationStatus::Idle);
+        }
+        evaluation->finished = true;
+    });
+}
+
+void ComputeGraph::ApplyAsyncEvaluation(AsyncEvaluation* evaluation) {
+    std::unordered_map<int, Vertex> vertices_by_id;
+    for (auto [current, end] = boost::vertices(graph); current != end; ++current) {
+        vertices_by_id[graph[*current].id] = *current;
+    }
+
+    if (evaluation->cancelled) {
+        for (const auto& id: evaluation->dirty_nodes) {
+            if (vertices_by_id.contains(id)) {
+                graph[vertices_by_id.at(id)].dirty = true;
+            }
+        }
+        return;
+    }
+
+    // Swap the back buffer in: outputs, fed inputs and remaining dirty flags of nodes that still exist
+    const auto& snapshot = evaluation->graph.graph;
+    for (auto [current, end] = boost::vertices(snapshot); current != end; ++current) {
+        const auto& evaluated = snapshot[*current];
+        if (!vertices_by_id.contains(evaluated.id)) {
+            continue;
+        }
+
+        auto& node = graph[vertices_by_id.at(evaluated.id)];
+        // Element-wise, so that the attribute storage the live plan points to stays in place
+        std::copy(evaluated.inputs.begin(), evaluated.inputs.end(), node.inputs.begin());
+        std::copy(evaluated.outputs.begin(), evaluated.outputs.end(), node.outputs.begin());
+        node.dirty = node.dirty || evaluated.dirty;
+    }
+}
 
-}
\ No newline at end of file
+}
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <functional>
 #include <list>
 #include <map>
+#include <optional>
 #include <set>
 #include <unordered_map>
 #include <utility>
@@ -13,10 +15,14 @@
 #include <boost/graph/graph_traits.hpp>
 #include <boost/graph/topological_sort.hpp>
 #include <entt/entt.hpp>
+#include <folly/executors/ManualExecutor.h>
 #include <imnodes/imnodes.h>
 
 #include <nncc/common/types.h>
 #include <nncc/common/utils.h>
+#include <nncc/compute/executor.h>
+#include <nncc/compute/profiler.h>
+#include <nncc/compute/tensor.h>
 #include <nncc/context/context.h>
 
 namespace nncc::compute {
@@ -24,6 +30,7 @@ namespace nncc::compute {
 enum class AttributeType {
     Float,
     String,
+    Tensor,
     UserDefined,
 
     Count,
@@ -38,7 +45,10 @@ struct Attribute {
     AttributeType type = AttributeType::None;
 
     entt::entity entity = entt::null;
-    std::variant<float, nncc::string> value;
+    std::variant<float, nncc::string, TensorView> value;
+
+    // Outputs get a fresh version on every evaluation of their node, inputs remember the version they were fed with
+    uint64_t version = 0;
 
     int id;
     static int id_counter;
@@ -46,31 +56,77 @@ struct Attribute {
     void Feed(const Attribute& other) {
         value = other.value;
         entity = other.entity;
+        version = other.version;
     };
+
+    // UserDefined attributes accept and produce anything, other types have to match exactly
+    static bool CanLink(const Attribute& output, const Attribute& input) {
+        return output.type == AttributeType::UserDefined || input.type == AttributeType::UserDefined ||
+               output.type == input.type;
+    }
 };
 
 
+// Identifies a pure node evaluated on given inputs and state, see EvaluationCache
+struct CacheKey {
+    int node_id = 0;
+    nncc::vector<uint64_t> fingerprint;
+    uint64_t hash = 0;
+
+    bool operator==(const CacheKey& other) const {
+        return node_id == other.node_id && fingerprint == other.fingerprint;
+    }
+};
+
 struct Result {
     int code = -1;
     nncc::string message = "Node was not fully evaluated.";
+
+    // The outputs were restored from the evaluation cache rather than computed
+    bool cached = false;
+
+    // Key of the inputs and state the outputs were computed from, taken before the evaluation
+    std::optional<CacheKey> cache_key;
 };
 
 struct ComputeNode;
 
+class EvaluationCache;
+
+// Nodes touching ImGui, bgfx, the entt registry or the Python interpreter, or reading state edited by their UI,
+// must be evaluated on the frame loop thread. Other nodes may run on the compute executor concurrently.
+enum class ThreadAffinity {
+    Any,
+    Main
+};
+
+enum class EvaluationStatus {
+    Idle,
+    Pending,
+    Running,
+    Done,
+    Failed
+};
+
 using EvaluateDelegate = entt::delegate<Result(ComputeNode*, entt::registry*)>;
 using RenderDelegate = entt::delegate<bool(ComputeNode*)>;
+using HashDelegate = entt::delegate<uint64_t(const ComputeNode*)>;
+
+// Evaluates a chain of nodes at once: node i + 1 reads the output 0 of node i through its input 0
+using FuseDelegate = entt::delegate<Result(ComputeNode* const*, size_t, entt::registry*)>;
 
 struct ComputeNode {
     ComputeNode() : id(id_counter++) {};
 
-    void AddInput(Attribute attribute) {
-        inputs_by_name.insert_or_assign(attribute.name, attribute);
-        inputs.push_back(attribute.name);
+    // Attributes are addressed by their index in declaration order, both by links and by evaluate functions
+    size_t AddInput(Attribute attribute) {
+        inputs.push_back(std::move(attribute));
+        return inputs.size() - 1;
     }
 
-    void AddOutput(Attribute attribute) {
-        outputs_by_name.insert_or_assign(attribute.name, attribute);
-        outputs.push_back(attribute.name);
+    size_t AddOutput(Attribute attribute) {
+        outputs.push_back(std::move(attribute));
+        return outputs.size() - 1;
     }
 
     template<class T>
@@ -78,6 +134,11 @@ struct ComputeNode {
         return std::static_pointer_cast<T>(state);
     }
 
+    // Output tensors should be allocated here: inside a graph they come from its arena and reuse released buffers
+    TensorView AllocateTensor(DType dtype, const int64_t* shape, size_t ndim) const {
+        return arena != nullptr ? arena->Allocate(dtype, shape, ndim) : TensorView::Allocate(dtype, shape, ndim);
+    }
+
     nncc::string type, name;
 
     int id;
@@ -87,48 +148,136 @@ struct ComputeNode {
     RenderDelegate render_ui;
     RenderDelegate render_context_ui;
 
-    nncc::list<nncc::string> inputs;
-    std::unordered_map<nncc::string, Attribute> inputs_by_name;
-
-    nncc::list<nncc::string> outputs;
-    std::unordered_map<nncc::string, Attribute> outputs_by_name;
+    nncc::vector<Attribute> inputs;
+    nncc::vector<Attribute> outputs;
 
     std::shared_ptr<void> state;
+
+    ThreadAffinity affinity = ThreadAffinity::Any;
+
+    // Pure nodes compute their outputs from their inputs alone, plus the part of their state hashed by hash_state.
+    // Their results are memoized: evaluating one with inputs seen recently restores its outputs instead.
+    bool pure = false;
+    HashDelegate hash_state;
+
+    // Set by ComputeGraph::Compile
+    TensorArena* arena = nullptr;
+
+    // Set by elementwise nodes. Chains of nodes with the same fuse delegate, whose intermediate outputs have no other
+    // consumers, are evaluated by it in a single pass; intermediate outputs are then left unmaterialized.
+    FuseDelegate fuse;
+
+    // Shared between copies of the node, so that the editor sees the progress of an asynchronous evaluation
+    std::shared_ptr<std::atomic<EvaluationStatus>> status =
+            std::make_shared<std::atomic<EvaluationStatus>>(EvaluationStatus::Idle);
+
+    // Set when the node has to be re-evaluated: its state was edited, an upstream node produced new outputs,
+    // or its links changed. ComputeGraph::Evaluate only visits dirty nodes.
+    bool dirty = true;
 };
 
 struct ComputeEdge {
-    nncc::string from_output;
-    nncc::string to_input;
+    uint32_t from_output;
+    uint32_t to_input;
+};
+
+
+// Flat lowering of a ComputeGraph, rebuilt only when its topology changes. Steps are sorted by dependency level,
+// each step refers to contiguous ranges of the links feeding it and of the steps consuming its outputs, so that
+// evaluation needs neither graph traversal nor attribute lookups by name.
+struct ExecutionPlan {
+    struct Step {
+        size_t vertex;
+        ComputeNode* node;
+
+        uint32_t links_begin, links_end;
+        uint32_t consumers_begin, consumers_end;
+
+        // The last step of a fused chain evaluates the whole chain, steps [chain_begin, chain_end) of `chains`.
+        // The other steps of the chain are absorbed and skipped.
+        uint32_t chain_begin = 0, chain_end = 0;
+        bool absorbed = false;
+    };
+
+    struct Link {
+        const Attribute* source;
+        uint32_t input;
+    };
+
+    nncc::vector<Step> steps;
+
+    // Level i consists of steps [levels[i], levels[i + 1])
+    nncc::vector<uint32_t> levels;
+
+    nncc::vector<Link> links;
+    nncc::vector<uint32_t> consumers;
+
+    nncc::vector<uint32_t> chains;
+    nncc::vector<ComputeNode*> chain_nodes;
 };
 
 
 struct ComputeGraph {
 public:
-    using Graph = boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS, ComputeNode, ComputeEdge>;
+    ComputeGraph();
+
+    ~ComputeGraph();
+
+    ComputeGraph(const ComputeGraph&) = delete;
+
+    void operator=(const ComputeGraph&) = delete;
+
+    using Graph = boost::adjacency_list<boost::vecS, boost::vecS, boost::bidirectionalS, ComputeNode, ComputeEdge>;
     using Vertex = boost::graph_traits<Graph>::vertex_descriptor;
     using Edge = boost::graph_traits<Graph>::edge_descriptor;
 
-    Vertex AddNode(const ComputeNode& node) {
-        return boost::add_vertex(node, graph);
-    }
+    Vertex AddNode(const ComputeNode& node);
 
-    void Evaluate(entt::registry* registry) {
-        nncc::vector<Vertex> sorted_vertices;
-        boost::topological_sort(graph, std::back_inserter(sorted_vertices));
+    Edge AddEdge(Vertex from, Vertex to, const ComputeEdge& edge);
 
-        for (auto it = sorted_vertices.rbegin(); it != sorted_vertices.rend(); ++it) {
-            auto& vertex = *it;
-            std::cout << graph[vertex].id << " " << graph[vertex].name << std::endl;
-            graph[vertex].evaluate(&graph[vertex], registry);
-            for (auto [current, end] = boost::adjacent_vertices(vertex, graph); current != end; ++current) {
-                auto edge = boost::edge(vertex, *current, graph).first;
+    void RemoveEdge(Edge edge);
 
-                auto source = boost::source(edge, graph), target = boost::target(edge, graph);
-                auto from = graph[edge].from_output, to = graph[edge].to_input;
+    void RemoveNode(Vertex vertex);
 
-                graph[target].inputs_by_name.at(to).Feed(graph[source].outputs_by_name.at(from));
-            }
-        }
+    // Re-evaluates dirty nodes and everything downstream of them. Clean nodes keep their outputs.
+    // Nodes are evaluated level by level: nodes of the same level do not depend on each other and run in parallel.
+    void Evaluate(entt::registry* registry);
+
+    // Requests an evaluation on the executor, working on a copy of the graph. Results are copied back into the nodes
+    // by Update once the evaluation has finished. Requests made while an evaluation is in flight let it finish and are
+    // coalesced into a single further evaluation of the latest graph.
+    void EvaluateAsync(entt::registry* registry);
+
+    // Must be called once per frame on the frame loop thread: evaluates ThreadAffinity::Main nodes of the evaluation
+    // in flight, applies finished results and starts the coalesced request, if any.
+    void Update();
+
+    bool IsEvaluating() const;
+
+    // Executor for nodes with ThreadAffinity::Any, the shared compute pool by default. Null evaluates serially.
+    void SetExecutor(folly::Executor* executor);
+
+    void MarkDirty(Vertex vertex);
+
+    void MarkAllDirty();
+
+    // Must be called after changing the topology of the underlying graph directly, bypassing the methods above
+    void InvalidateTopology();
+
+    // Lowers the graph into an execution plan unless the current one is still valid. Called by Evaluate.
+    const ExecutionPlan& Compile();
+
+    const TensorArena& Arena() const {
+        return *arena_;
+    }
+
+    // Timings of node evaluations, including the ones made in the background
+    EvaluationProfiler& Profiler() const {
+        return *profiler_;
+    }
+
+    EvaluationCache& Cache() const {
+        return *cache_;
     }
 
     const Graph& operator*() const {
@@ -140,6 +289,62 @@ public:
     };
 
     Graph graph {};
+
+private:
+    struct AsyncEvaluation;
+
+    void StartAsyncEvaluation();
+
+    void ApplyAsyncEvaluation(AsyncEvaluation* evaluation);
+
+    void FuseElementwiseChains();
+
+    void PullInputs(const ExecutionPlan::Step& step);
+
+    // `owner` is the scheduled step whose success lets the released tensors go, the last one of a fused chain
+    void ReleaseOutputs(const ExecutionPlan::Step& step, uint32_t owner);
+
+    // Gives the steps that failed their released tensors back and lets the others go
+    void RestoreReleased(const nncc::vector<uint32_t>& failed);
+
+    Result EvaluateStep(const ExecutionPlan::Step& step, entt::registry* registry) const;
+
+    void FinishStep(const ExecutionPlan::Step& step, const Result& result);
+
+    void EvaluateLevel(uint32_t level, entt::registry* registry);
+
+    void FinishNode(const ExecutionPlan::Step& step, const Result& result);
+
+    ExecutionPlan plan_;
+    bool plan_valid_ = false;
+
+    // Shared with the background copy, whose outputs replace the live ones once it is done
+    std::shared_ptr<TensorArena> arena_ = std::make_shared<TensorArena>();
+    std::shared_ptr<EvaluationProfiler> profiler_ = std::make_shared<EvaluationProfiler>();
+    std::shared_ptr<EvaluationCache> cache_;
+
+    folly::Executor* executor_ = GetComputeExecutor();
+    nncc::vector<uint32_t> scheduled_;
+
+    // Tensors set aside by ReleaseOutputs while the steps of a level run
+    struct ReleasedTensor {
+        uint32_t step;
+        Attribute* attribute;
+        TensorView value;
+        uint64_t version;
+    };
+    nncc::vector<ReleasedTensor> released_;
+
+    // Set for the copy of the graph evaluated in the background: ThreadAffinity::Main nodes are sent there
+    folly::Executor* main_executor_ = nullptr;
+
+    folly::ManualExecutor main_thread_tasks_;
+    std::unique_ptr<AsyncEvaluation> evaluation_;
+    entt::registry* pending_registry_ = nullptr;
+    bool pending_ = false;
+
+    // Shared by all graphs so that versions of different outputs never collide when an input is re-linked
+    static std::atomic<uint64_t> version_counter_;
 };
 
 
@@ -171,6 +376,7 @@ public:
     }
 
     void Update() {
+        graph_.Update();
         selected_nodes_.clear();
 
         auto flags = ImGuiWindowFlags_MenuBar;
@@ -217,7 +423,7 @@ public:
 private:
     struct AttributeDescriptor {
         ComputeGraph::Vertex vertex;
-        Attribute* attribute;
+        uint32_t index;
         bool is_input = false;
     };
 
@@ -232,6 +438,7 @@ private:
 
     nncc::vector<ComputeNode*> selected_nodes_;
     ImNodesMiniMapLocation minimap_location_;
+    bool show_heat_ = true;
 
     void ShowMenuBar() {
         if (ImGui::BeginMenuBar()) {
@@ -257,6 +464,20 @@ private:
                 ImGui::EndMenu();
             }
 
+            if (ImGui::BeginMenu("Profiler")) {
+                ImGui::MenuItem("Heat coloring", nullptr, &show_heat_);
+                if (ImGui::MenuItem("Export Chrome trace")) {
+                    const nncc::string path = "nncc_trace.json";
+                    context::Context::Get()->log_message = graph_.Profiler().WriteChromeTrace(path)
+                                                           ? fmt::format("Trace written to {}.", path)
+                                                           : fmt::format("Could not write {}.", path);
+                }
+                if (ImGui::MenuItem("Reset")) {
+                    graph_.Profiler().Clear();
+                }
+                ImGui::EndMenu();
+            }
+
             if (ImGui::BeginMenu("Style")) {
                 if (ImGui::MenuItem("Classic")) {
                     ImGui::StyleColorsClassic();
@@ -320,15 +541,45 @@ private:
             auto& node = (*graph_)[vertex];
 
             const float node_width = 100.f * scale_;
+
+            // Title bars go from the usual blue to red as the node's share of evaluation time grows
+            const auto stats = graph_.Profiler().Stats(node.id);
+            const bool heat = show_heat_ && stats.calls > 0;
+            if (heat) {
+                auto lerp = [&stats](int from, int to) {
+                    return static_cast<int>(static_cast<float>(from) + static_cast<float>(to - from) * stats.heat);
+                };
+                const auto color = IM_COL32(lerp(41, 200), lerp(74, 40), lerp(122, 40), 255);
+                ImNodes::PushColorStyle(ImNodesCol_TitleBar, color);
+                ImNodes::PushColorStyle(ImNodesCol_TitleBarHovered, color);
+                ImNodes::PushColorStyle(ImNodesCol_TitleBarSelected, color);
+            }
             ImNodes::BeginNode(node.id);
 
             ImNodes::BeginNodeTitleBar();
             ImGui::TextUnformatted(node.name.c_str());
+            auto status = node.status->load();
+            if (status == EvaluationStatus::Pending || status == EvaluationStatus::Running) {
+                ImGui::SameLine();
+                ImGui::TextDisabled(status == EvaluationStatus::Pending ? "pending" : "running");
+            } else if (status == EvaluationStatus::Failed) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("failed");
+            } else if (heat) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("%.2f ms", stats.MeanMilliseconds());
+            }
             ImNodes::EndNodeTitleBar();
-            for (auto& name: node.inputs) {
-                auto& input = node.inputs_by_name.at(name);
+            if (heat && ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("%llu calls, %llu failed, %.1f%% of evaluation time, %.1f MB produced",
+                                  static_cast<unsigned long long>(stats.calls),
+                                  static_cast<unsigned long long>(stats.failures), stats.heat * 100.0f,
+                                  static_cast<double>(stats.bytes) / static_cast<double>(1 << 20));
+            }
+            for (uint32_t i = 0; i < node.inputs.size(); ++i) {
+                auto& input = node.inputs[i];
                 ImNodes::BeginInputAttribute(input.id);
-                attribute_map_.insert_or_assign(input.id, AttributeDescriptor{vertex, &input, true});
+                attribute_map_.insert_or_assign(input.id, AttributeDescriptor{vertex, i, true});
                 const float label_width = ImGui::CalcTextSize(input.name.c_str()).x;
                 ImGui::TextUnformatted(input.name.c_str());
 
@@ -338,6 +589,8 @@ private:
                     ImGui::TextUnformatted(fmt::format("{:.4g}", std::get<float>(input.value)).c_str());
                 } else if (std::holds_alternative<nncc::string>(input.value)) {
                     ImGui::TextUnformatted(std::get<nncc::string>(input.value).c_str());
+                } else if (std::holds_alternative<TensorView>(input.value)) {
+                    ImGui::TextUnformatted(std::get<TensorView>(input.value).Describe().c_str());
                 }
 
                 ImGui::PopItemWidth();
@@ -347,16 +600,18 @@ private:
 
             ImGui::Spacing();
 
-            for (auto& name: node.outputs) {
+            for (uint32_t i = 0; i < node.outputs.size(); ++i) {
                 {
-                    auto& output = node.outputs_by_name.at(name);
+                    auto& output = node.outputs[i];
                     ImNodes::BeginOutputAttribute(output.id);
-                    attribute_map_.insert_or_assign(output.id, AttributeDescriptor{vertex, &output, false});
+                    attribute_map_.insert_or_assign(output.id, AttributeDescriptor{vertex, i, false});
                     nncc::string type;
                     if (output.type == AttributeType::Float) {
                         type = "float";
                     } else if (output.type == AttributeType::String) {
                         type = "string";
+                    } else if (output.type == AttributeType::Tensor) {
+                        type = "tensor";
                     } else if (output.type == AttributeType::UserDefined) {
                         type = "T";
                     }
@@ -370,6 +625,11 @@ private:
             }
 
             ImNodes::EndNode();
+            if (heat) {
+                ImNodes::PopColorStyle();
+                ImNodes::PopColorStyle();
+                ImNodes::PopColorStyle();
+            }
         }
     }
 
@@ -384,9 +644,7 @@ private:
             const auto& target_node = (*graph_)[boost::target(*current_edge, *graph_)];
 
             auto id = edge_id++;
-            ImNodes::Link(id,
-                          source_node.outputs_by_name.at(edge.from_output).id,
-                          target_node.inputs_by_name.at(edge.to_input).id);
+            ImNodes::Link(id, source_node.outputs[edge.from_output].id, target_node.inputs[edge.to_input].id);
             edge_map_[id] = *current_edge;
         }
     }
@@ -400,17 +658,27 @@ private:
         auto start = attribute_map_[start_attr];
         auto end = attribute_map_[end_attr];
 
-        if (!start.is_input && end.is_input) {
-            boost::add_edge(start.vertex, end.vertex, {start.attribute->name, end.attribute->name}, *graph_);
+        if (start.is_input || !end.is_input) {
+            return;
+        }
+
+        const auto& output = (*graph_)[start.vertex].outputs[start.index];
+        const auto& input = (*graph_)[end.vertex].inputs[end.index];
+        if (!Attribute::CanLink(output, input)) {
+            context::Context::Get()->log_message = fmt::format("Cannot link {} to {}: attribute types differ.",
+                                                               output.name, input.name);
+            return;
         }
 
-        graph_.Evaluate(&context::Context::Get()->registry);
+        graph_.AddEdge(start.vertex, end.vertex, {start.index, end.index});
+
+        graph_.EvaluateAsync(&context::Context::Get()->registry);
     }
 
     void HandleDeletedLinks() {
         int link_id;
         if (ImNodes::IsLinkDestroyed(&link_id)) {
-            boost::remove_edge(edge_map_.at(link_id), *graph_);
+            graph_.RemoveEdge(edge_map_.at(link_id));
             edge_map_.erase(link_id);
         }
 
@@ -423,7 +691,7 @@ private:
         selected_links.resize(static_cast<size_t>(num_selected));
         ImNodes::GetSelectedLinks(selected_links.data());
         for (const auto& link: selected_links) {
-            boost::remove_edge(edge_map_.at(link), *graph_);
+            graph_.RemoveEdge(edge_map_.at(link));
             edge_map_.erase(link);
         }
     }
@@ -444,10 +712,10 @@ private:
             nncc::vector<int> attribute_ids;
 //            attribute_ids.reserve(node.inputs.size() + node.outputs.size() + node.settings.size());
             attribute_ids.reserve(node.inputs.size() + node.outputs.size());
-            for (const auto& [name, attribute]: node.inputs_by_name) {
+            for (const auto& attribute: node.inputs) {
                 attribute_ids.push_back(attribute.id);
             }
-            for (const auto& [name, attribute]: node.outputs_by_name) {
+            for (const auto& attribute: node.outputs) {
                 attribute_ids.push_back(attribute.id);
             }
 //            for (const auto& [name, attribute]: node.settings_by_name) {
@@ -457,7 +725,7 @@ private:
                 attribute_map_.erase(id);
             }
 
-            boost::remove_vertex(vertex, *graph_);
+            graph_.RemoveNode(vertex);
         }
     }
 
@@ -0,0 +1,117 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fmt/format.h>
+
+namespace nncc::compute {
+
+namespace {
+
+nncc::string EscapeJson(const nncc::string& text) {
+    nncc::string escaped;
+    escaped.reserve(text.size());
+    for (const auto& c: text) {
+        if (c == '"' || c == '\\') {
+            escaped.push_back('\\');
+            escaped.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+}
+
+EvaluationProfiler::EvaluationProfiler(size_t window) : samples_(std::max<size_t>(window, 1)) {}
+
+void EvaluationProfiler::Record(const NodeSample& sample) {
+    if (!enabled_) {
+        return;
+    }
+
+    std::lock_guard lock(mutex_);
+    if (count_ == samples_.size()) {
+        const auto& evicted = samples_[next_];
+        auto& stats = stats_[evicted.node_id];
+        --stats.calls;
+        stats.failures -= evicted.code != 0 ? 1 : 0;
+        stats.total_time -= evicted.end - evicted.begin;
+        stats.bytes -= evicted.bytes;
+        total_time_ -= evicted.end - evicted.begin;
+    } else {
+        ++count_;
+    }
+
+    samples_[next_] = sample;
+    next_ = (next_ + 1) % samples_.size();
+
+    auto& stats = stats_[sample.node_id];
+    ++stats.calls;
+    stats.failures += sample.code != 0 ? 1 : 0;
+    stats.total_time += sample.end - sample.begin;
+    stats.bytes += sample.bytes;
+    stats.last_code = sample.code;
+    total_time_ += sample.end - sample.begin;
+}
+
+void EvaluationProfiler::SetNodeName(int node_id, const nncc::string& name) {
+    std::lock_guard lock(mutex_);
+    names_.insert_or_assign(node_id, name);
+}
+
+NodeStats EvaluationProfiler::Stats(int node_id) const {
+    std::lock_guard lock(mutex_);
+    auto found = stats_.find(node_id);
+    if (found == stats_.end()) {
+        return {};
+    }
+
+    auto stats = found->second;
+    stats.heat = total_time_ > 0 ? static_cast<float>(stats.total_time) / static_cast<float>(total_time_) : 0.0f;
+    return stats;
+}
+
+nncc::string EvaluationProfiler::ChromeTrace() const {
+    std::lock_guard lock(mutex_);
+
+    nncc::string trace = "{\"traceEvents\":[";
+    const auto first = (next_ + samples_.size() - count_) % samples_.size();
+    for (size_t i = 0; i < count_; ++i) {
+        const auto& sample = samples_[(first + i) % samples_.size()];
+        auto name = names_.find(sample.node_id);
+
+        if (i > 0) {
+            trace += ",";
+        }
+        // Complete events, timestamps in microseconds
+        trace += fmt::format(
+                "{{\"name\":\"{}\",\"cat\":\"node\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":0,\"tid\":{},"
+                "\"args\":{{\"id\":{},\"bytes\":{},\"code\":{},\"fused\":{}}}}}",
+                name != names_.end() ? EscapeJson(name->second) : fmt::format("node {}", sample.node_id),
+                static_cast<double>(sample.begin) / 1e3, static_cast<double>(sample.end - sample.begin) / 1e3,
+                sample.thread, sample.node_id, sample.bytes, sample.code, sample.fused);
+    }
+    trace += "]}";
+    return trace;
+}
+
+bool EvaluationProfiler::WriteChromeTrace(const nncc::string& path) const {
+    std::ofstream file(path.c_str());
+    file << ChromeTrace();
+    return file.good();
+}
+
+void EvaluationProfiler::Clear() {
+    std::lock_guard lock(mutex_);
+    next_ = 0;
+    count_ = 0;
+    total_time_ = 0;
+    stats_.clear();
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include <nncc/common/types.h>
+
+namespace nncc::compute {
+
+// One evaluation of a node, or of a fused chain, which is attributed to its last node
+struct NodeSample {
+    int node_id = 0;
+
+    // Nanoseconds since the profiler was created
+    int64_t begin = 0, end = 0;
+
+    uint64_t thread = 0;
+    size_t bytes = 0;
+    int code = 0;
+    uint32_t fused = 1;
+};
+
+// Aggregates over the profiler's window
+struct NodeStats {
+    uint64_t calls = 0;
+    uint64_t failures = 0;
+    int64_t total_time = 0;
+    size_t bytes = 0;
+    int last_code = 0;
+
+    // Share of the time spent in all nodes of the window, in [0, 1]
+    float heat = 0.0f;
+
+    [[nodiscard]] double MeanMilliseconds() const {
+        return calls > 0 ? static_cast<double>(total_time) / static_cast<double>(calls) / 1e6 : 0.0;
+    }
+};
+
+// Keeps the last `window` node evaluations of a graph. Recording takes a clock read and a short lock, cheap enough
+// to stay enabled; per-node aggregates are maintained as samples enter and leave the window. Thread-safe.
+class EvaluationProfiler {
+public:
+    explicit EvaluationProfiler(size_t window = 4096);
+
+    [[nodiscard]] int64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    void Record(const NodeSample& sample);
+
+    // Node names are only needed for traces, so they are registered once rather than recorded with every sample
+    void SetNodeName(int node_id, const nncc::string& name);
+
+    [[nodiscard]] NodeStats Stats(int node_id) const;
+
+    // Samples of the window in the Chrome trace event format, to be opened in chrome://tracing or Perfetto
+    [[nodiscard]] nncc::string ChromeTrace() const;
+
+    bool WriteChromeTrace(const nncc::string& path) const;
+
+    void Clear();
+
+    void SetEnabled(bool enabled) {
+        enabled_ = enabled;
+    }
+
+    [[nodiscard]] bool IsEnabled() const {
+        return enabled_;
+    }
+
+private:
+    const std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+    std::atomic<bool> enabled_ = true;
+
+    mutable std::mutex mutex_;
+    nncc::vector<NodeSample> samples_;
+    size_t next_ = 0, count_ = 0;
+    int64_t total_time_ = 0;
+    std::unordered_map<int, NodeStats> stats_;
+    std::unordered_map<int, nncc::string> names_;
+};
+
+}
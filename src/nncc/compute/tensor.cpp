@@ -0,0 +1,178 @@
+#include "tensor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace nncc::compute {
+
+size_t ElementSize(DType dtype) {
+    switch (dtype) {
+        case DType::UInt8:
+            return 1;
+        case DType::Float16:
+        case DType::BFloat16:
+            return 2;
+        case DType::Int32:
+        case DType::Float32:
+            return 4;
+        default:
+            throw std::runtime_error("Unknown tensor dtype.");
+    }
+}
+
+const char* DTypeName(DType dtype) {
+    switch (dtype) {
+        case DType::UInt8:
+            return "uint8";
+        case DType::Int32:
+            return "int32";
+        case DType::Float16:
+            return "float16";
+        case DType::BFloat16:
+            return "bfloat16";
+        case DType::Float32:
+            return "float32";
+        default:
+            return "unknown";
+    }
+}
+
+TensorView::TensorView(DType _dtype, std::initializer_list<int64_t> _shape, void* _data, std::shared_ptr<void> _owner)
+        : TensorView(_dtype, _shape.begin(), _shape.size(), _data, std::move(_owner)) {}
+
+TensorView::TensorView(DType _dtype, const int64_t* _shape, size_t _ndim, void* _data, std::shared_ptr<void> _owner)
+        : dtype(_dtype), ndim(_ndim), data(_data), owner(std::move(_owner)) {
+    if (ndim > kMaxTensorDims) {
+        throw std::runtime_error(fmt::format("Tensors can have at most {} dimensions, got {}.", kMaxTensorDims, ndim));
+    }
+
+    int64_t stride = 1;
+    for (size_t i = ndim; i-- > 0;) {
+        shape[i] = _shape[i];
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+}
+
+TensorView TensorView::Allocate(DType dtype, const int64_t* shape, size_t ndim) {
+    TensorView view(dtype, shape, ndim, nullptr, nullptr);
+    auto buffer = std::shared_ptr<uint8_t[]>(new uint8_t[view.Bytes()]);
+    view.data = buffer.get();
+    view.owner = std::move(buffer);
+    return view;
+}
+
+int64_t TensorView::Numel() const {
+    int64_t numel = 1;
+    for (size_t i = 0; i < ndim; ++i) {
+        numel *= shape[i];
+    }
+    return numel;
+}
+
+bool TensorView::IsContiguous() const {
+    int64_t stride = 1;
+    for (size_t i = ndim; i-- > 0;) {
+        if (shape[i] != 1 && strides[i] != stride) {
+            return false;
+        }
+        stride *= shape[i];
+    }
+    return true;
+}
+
+bool TensorView::SameShape(const TensorView& other) const {
+    if (ndim != other.ndim) {
+        return false;
+    }
+    for (size_t i = 0; i < ndim; ++i) {
+        if (shape[i] != other.shape[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TensorView TensorView::Slice(size_t dim, int64_t begin, int64_t end) const {
+    if (dim >= ndim || begin < 0 || end > shape[dim] || begin > end) {
+        throw std::runtime_error(fmt::format("Invalid slice [{}, {}) of dimension {} of {}.", begin, end, dim, Describe()));
+    }
+
+    TensorView view = *this;
+    view.shape[dim] = end - begin;
+    view.data = static_cast<uint8_t*>(data) + begin * strides[dim] * ElementSize(dtype);
+    return view;
+}
+
+nncc::string TensorView::Describe() const {
+    nncc::string dims;
+    for (size_t i = 0; i < ndim; ++i) {
+        dims += i == 0 ? fmt::format("{}", shape[i]) : fmt::format("x{}", shape[i]);
+    }
+    return fmt::format("{}[{}]", DTypeName(dtype), dims);
+}
+
+namespace {
+
+// Cache line alignment keeps vector loads of arena tensors aligned
+constexpr size_t kArenaAlignment = 64;
+
+}
+
+TensorView TensorArena::Allocate(DType dtype, const int64_t* shape, size_t ndim) {
+    TensorView view(dtype, shape, ndim, nullptr, nullptr);
+    const auto bytes = view.Bytes();
+
+    std::lock_guard lock(mutex_);
+
+    // Best fit among the free blocks, not wasting more than half of a block on a smaller tensor
+    Block* best = nullptr;
+    for (auto& block: blocks_) {
+        // Only the arena refers to the block, and new references are only made here, under the lock
+        if (block.storage.use_count() != 1 || block.bytes < bytes || block.bytes / 2 > bytes) {
+            continue;
+        }
+        if (best == nullptr || block.bytes < best->bytes) {
+            best = &block;
+        }
+    }
+
+    if (best == nullptr) {
+        const auto size = std::max(kArenaAlignment, (bytes + kArenaAlignment - 1) / kArenaAlignment * kArenaAlignment);
+        auto* memory = std::aligned_alloc(kArenaAlignment, size);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        blocks_.push_back(Block{std::shared_ptr<void>(memory, std::free), size, epoch_});
+        best = &blocks_.back();
+    }
+
+    best->last_used = epoch_;
+    view.data = best->storage.get();
+    view.owner = best->storage;
+    return view;
+}
+
+void TensorArena::Collect(uint32_t max_idle) {
+    std::lock_guard lock(mutex_);
+    ++epoch_;
+    auto idle = std::remove_if(blocks_.begin(), blocks_.end(), [this, max_idle](const Block& block) {
+        return block.storage.use_count() == 1 && block.last_used + max_idle < epoch_;
+    });
+    blocks_.erase(idle, blocks_.end());
+}
+
+size_t TensorArena::ReservedBytes() const {
+    std::lock_guard lock(mutex_);
+    size_t bytes = 0;
+    for (const auto& block: blocks_) {
+        bytes += block.bytes;
+    }
+    return bytes;
+}
+
+}
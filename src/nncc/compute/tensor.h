@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <nncc/common/types.h>
+
+namespace nncc::compute {
+
+enum class DType : uint8_t {
+    UInt8,
+    Int32,
+    Float16,
+    BFloat16,
+    Float32,
+
+    Count
+};
+
+size_t ElementSize(DType dtype);
+
+const char* DTypeName(DType dtype);
+
+constexpr size_t kMaxTensorDims = 8;
+
+// Reference-counted, typed view into tensor memory owned elsewhere: a shared memory mapping, a graph arena or the heap.
+// Copying a view never copies or allocates tensor memory, so tensors travel along graph edges for free.
+struct TensorView {
+    TensorView() = default;
+
+    TensorView(DType _dtype, std::initializer_list<int64_t> _shape, void* _data, std::shared_ptr<void> _owner);
+
+    TensorView(DType _dtype, const int64_t* _shape, size_t _ndim, void* _data, std::shared_ptr<void> _owner);
+
+    // A contiguous tensor backed by its own heap buffer
+    static TensorView Allocate(DType dtype, const int64_t* shape, size_t ndim);
+
+    [[nodiscard]] int64_t Numel() const;
+
+    [[nodiscard]] size_t Bytes() const {
+        return static_cast<size_t>(Numel()) * ElementSize(dtype);
+    }
+
+    [[nodiscard]] bool IsContiguous() const;
+
+    [[nodiscard]] bool SameShape(const TensorView& other) const;
+
+    // Zero-copy view of [begin, end) along dimension `dim`
+    [[nodiscard]] TensorView Slice(size_t dim, int64_t begin, int64_t end) const;
+
+    [[nodiscard]] nncc::string Describe() const;
+
+    template<class T>
+    T* As() const {
+        return static_cast<T*>(data);
+    }
+
+    [[nodiscard]] bool Empty() const {
+        return data == nullptr;
+    }
+
+    DType dtype = DType::Float32;
+    size_t ndim = 0;
+    std::array<int64_t, kMaxTensorDims> shape{};
+
+    // In elements, not bytes
+    std::array<int64_t, kMaxTensorDims> strides{};
+
+    void* data = nullptr;
+    std::shared_ptr<void> owner;
+};
+
+// Recycles tensor buffers. A buffer is free again as soon as no view refers to it, and is handed out for the next
+// request of a similar size, so that evaluating a graph over and over does not allocate tensor memory.
+// Buffers stay valid as long as views of them exist, even past the arena's lifetime. Thread-safe.
+class TensorArena {
+public:
+    TensorView Allocate(DType dtype, const int64_t* shape, size_t ndim);
+
+    // Frees buffers that were not handed out during the last `max_idle` collections
+    void Collect(uint32_t max_idle = 2);
+
+    [[nodiscard]] size_t ReservedBytes() const;
+
+private:
+    struct Block {
+        std::shared_ptr<void> storage;
+        size_t bytes;
+        uint64_t last_used;
+    };
+
+    mutable std::mutex mutex_;
+    nncc::vector<Block> blocks_;
+    uint64_t epoch_ = 0;
+};
+
+}
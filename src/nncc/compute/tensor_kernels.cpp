@@ -0,0 +1,329 @@
+#include "tensor_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NNCC_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define NNCC_KERNELS_X86 0
+#endif
+
+namespace nncc::compute::kernels {
+
+namespace {
+
+// Scalar versions, also used for the tails of the vectorized loops
+
+float ApplyBinary(BinaryOp op, float a, float b) {
+    switch (op) {
+        case BinaryOp::Add:
+            return a + b;
+        case BinaryOp::Sub:
+            return a - b;
+        case BinaryOp::Mul:
+            return a * b;
+        case BinaryOp::Div:
+            return a / b;
+    }
+    return 0.0f;
+}
+
+void BinaryScalar(BinaryOp op, const float* a, const float* b, float* out, size_t begin, size_t count) {
+    for (auto i = begin; i < count; ++i) {
+        out[i] = ApplyBinary(op, a[i], b[i]);
+    }
+}
+
+void AffineScalar(const float* x, float scale, float bias, float* out, size_t begin, size_t count) {
+    for (auto i = begin; i < count; ++i) {
+        out[i] = x[i] * scale + bias;
+    }
+}
+
+void ClampScalar(const float* x, float low, float high, float* out, size_t begin, size_t count) {
+    for (auto i = begin; i < count; ++i) {
+        out[i] = std::min(std::max(x[i], low), high);
+    }
+}
+
+// All paths saturate to [0, 255] before rounding, and map NaN to 0 as max(NaN, 0) does in the vector ones
+void FloatToUInt8Scalar(const float* x, float scale, uint8_t* out, size_t begin, size_t count) {
+    for (auto i = begin; i < count; ++i) {
+        const auto value = x[i] * scale;
+        out[i] = value > 0.0f ? static_cast<uint8_t>(std::nearbyint(std::min(value, 255.0f))) : 0;
+    }
+}
+
+void UInt8ToFloatScalar(const uint8_t* x, float scale, float* out, size_t begin, size_t count) {
+    for (auto i = begin; i < count; ++i) {
+        out[i] = static_cast<float>(x[i]) * scale;
+    }
+}
+
+#if NNCC_KERNELS_X86
+
+// SSE2 is part of x86-64, so these need no dispatch
+
+size_t BinarySse(BinaryOp op, const float* a, const float* b, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+        __m128 result;
+        switch (op) {
+            case BinaryOp::Add:
+                result = _mm_add_ps(va, vb);
+                break;
+            case BinaryOp::Sub:
+                result = _mm_sub_ps(va, vb);
+                break;
+            case BinaryOp::Mul:
+                result = _mm_mul_ps(va, vb);
+                break;
+            default:
+                result = _mm_div_ps(va, vb);
+                break;
+        }
+        _mm_storeu_ps(out + i, result);
+    }
+    return i;
+}
+
+size_t AffineSse(const float* x, float scale, float bias, float* out, size_t count) {
+    const auto vscale = _mm_set1_ps(scale), vbias = _mm_set1_ps(bias);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), vscale), vbias));
+    }
+    return i;
+}
+
+size_t ClampSse(const float* x, float low, float high, float* out, size_t count) {
+    const auto vlow = _mm_set1_ps(low), vhigh = _mm_set1_ps(high);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x + i), vlow), vhigh));
+    }
+    return i;
+}
+
+// Clamped before the conversion, which turns NaN and values past INT32_MAX into INT32_MIN. max takes its second
+// operand when the first is NaN.
+inline __m128i ScaleToUInt8RangeSse(const float* x, __m128 scale) {
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(x), scale), _mm_setzero_ps()),
+                                      _mm_set1_ps(255.0f)));
+}
+
+size_t FloatToUInt8Sse(const float* x, float scale, uint8_t* out, size_t count) {
+    const auto vscale = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto a = ScaleToUInt8RangeSse(x + i, vscale), b = ScaleToUInt8RangeSse(x + i + 4, vscale);
+        auto c = ScaleToUInt8RangeSse(x + i + 8, vscale), d = ScaleToUInt8RangeSse(x + i + 12, vscale);
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    return i;
+}
+
+size_t UInt8ToFloatSse(const uint8_t* x, float scale, float* out, size_t count) {
+    const auto vscale = _mm_set1_ps(scale);
+    const auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        auto low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i words[4] = {
+                _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero),
+        };
+        for (int j = 0; j < 4; ++j) {
+            _mm_storeu_ps(out + i + 4 * j, _mm_mul_ps(_mm_cvtepi32_ps(words[j]), vscale));
+        }
+    }
+    return i;
+}
+
+// Offset of the first vector that differs, or of the tail if none does
+size_t MismatchSse(const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        if (_mm_movemask_epi8(equal) != 0xFFFF) {
+            break;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t BinaryAvx2(BinaryOp op, const float* a, const float* b, float* out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto va = _mm256_loadu_ps(a + i), vb = _mm256_loadu_ps(b + i);
+        __m256 result;
+        switch (op) {
+            case BinaryOp::Add:
+                result = _mm256_add_ps(va, vb);
+                break;
+            case BinaryOp::Sub:
+                result = _mm256_sub_ps(va, vb);
+                break;
+            case BinaryOp::Mul:
+                result = _mm256_mul_ps(va, vb);
+                break;
+            default:
+                result = _mm256_div_ps(va, vb);
+                break;
+        }
+        _mm256_storeu_ps(out + i, result);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t AffineAvx2(const float* x, float scale, float bias, float* out, size_t count) {
+    const auto vscale = _mm256_set1_ps(scale), vbias = _mm256_set1_ps(bias);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), vscale), vbias));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t ClampAvx2(const float* x, float low, float high, float* out, size_t count) {
+    const auto vlow = _mm256_set1_ps(low), vhigh = _mm256_set1_ps(high);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(x + i), vlow), vhigh));
+    }
+    return i;
+}
+
+// See ScaleToUInt8RangeSse
+__attribute__((target("avx2")))
+inline __m256i ScaleToUInt8RangeAvx2(const float* x, __m256 scale) {
+    return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(x), scale),
+                                                          _mm256_setzero_ps()), _mm256_set1_ps(255.0f)));
+}
+
+__attribute__((target("avx2")))
+size_t FloatToUInt8Avx2(const float* x, float scale, uint8_t* out, size_t count) {
+    const auto vscale = _mm256_set1_ps(scale);
+    // Packing works within 128-bit lanes, this restores the element order afterwards
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto a = ScaleToUInt8RangeAvx2(x + i, vscale), b = ScaleToUInt8RangeAvx2(x + i + 8, vscale);
+        auto c = ScaleToUInt8RangeAvx2(x + i + 16, vscale), d = ScaleToUInt8RangeAvx2(x + i + 24, vscale);
+        auto packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t UInt8ToFloatAvx2(const uint8_t* x, float scale, float* out, size_t count) {
+    const auto vscale = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), vscale));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t MismatchAvx2(const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        if (_mm256_movemask_epi8(equal) != -1) {
+            break;
+        }
+    }
+    return i;
+}
+
+#endif
+
+}
+
+bool HasAvx2() {
+#if NNCC_KERNELS_X86 && (defined(__GNUC__) || defined(__clang__))
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+void Binary(BinaryOp op, const float* a, const float* b, float* out, size_t count) {
+    size_t done = 0;
+#if NNCC_KERNELS_X86
+    done = HasAvx2() ? BinaryAvx2(op, a, b, out, count) : BinarySse(op, a, b, out, count);
+#endif
+    BinaryScalar(op, a, b, out, done, count);
+}
+
+void Affine(const float* x, float scale, float bias, float* out, size_t count) {
+    size_t done = 0;
+#if NNCC_KERNELS_X86
+    done = HasAvx2() ? AffineAvx2(x, scale, bias, out, count) : AffineSse(x, scale, bias, out, count);
+#endif
+    AffineScalar(x, scale, bias, out, done, count);
+}
+
+void Clamp(const float* x, float low, float high, float* out, size_t count) {
+    size_t done = 0;
+#if NNCC_KERNELS_X86
+    done = HasAvx2() ? ClampAvx2(x, low, high, out, count) : ClampSse(x, low, high, out, count);
+#endif
+    ClampScalar(x, low, high, out, done, count);
+}
+
+void FloatToUInt8(const float* x, float scale, uint8_t* out, size_t count) {
+    size_t done = 0;
+#if NNCC_KERNELS_X86
+    done = HasAvx2() ? FloatToUInt8Avx2(x, scale, out, count) : FloatToUInt8Sse(x, scale, out, count);
+#endif
+    FloatToUInt8Scalar(x, scale, out, done, count);
+}
+
+void UInt8ToFloat(const uint8_t* x, float scale, float* out, size_t count) {
+    size_t done = 0;
+#if NNCC_KERNELS_X86
+    done = HasAvx2() ? UInt8ToFloatAvx2(x, scale, out, count) : UInt8ToFloatSse(x, scale, out, count);
+#endif
+    UInt8ToFloatScalar(x, scale, out, done, count);
+}
+
+void Swizzle(const uint8_t* in, size_t in_channels, const uint8_t* order, size_t out_channels, size_t element_size,
+             size_t pixels, uint8_t* out) {
+    const auto in_pixel = in_channels * element_size, out_pixel = out_channels * element_size;
+    for (size_t p = 0; p < pixels; ++p) {
+        for (size_t c = 0; c < out_channels; ++c) {
+            std::memcpy(out + p * out_pixel + c * element_size, in + p * in_pixel + order[c] * element_size,
+                        element_size);
+        }
+    }
+}
+
+bool CopyIfChanged(const uint8_t* in, uint8_t* previous, size_t count) {
+    size_t same = 0;
+#if NNCC_KERNELS_X86
+    same = HasAvx2() ? MismatchAvx2(in, previous, count) : MismatchSse(in, previous, count);
+#endif
+    if (std::memcmp(in + same, previous + same, count - same) == 0) {
+        return false;
+    }
+    std::memcpy(previous + same, in + same, count - same);
+    return true;
+}
+
+}
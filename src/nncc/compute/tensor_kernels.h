@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nncc::compute::kernels {
+
+// Contiguous elementwise kernels. On x86-64 they use AVX2 when the CPU supports it and SSE2 otherwise,
+// elsewhere they are plain loops left to the compiler's auto-vectorizer. Inputs and outputs may alias.
+
+enum class BinaryOp {
+    Add,
+    Sub,
+    Mul,
+    Div
+};
+
+void Binary(BinaryOp op, const float* a, const float* b, float* out, size_t count);
+
+// out = x * scale + bias
+void Affine(const float* x, float scale, float bias, float* out, size_t count);
+
+void Clamp(const float* x, float low, float high, float* out, size_t count);
+
+// out = saturate(round(x * scale))
+void FloatToUInt8(const float* x, float scale, uint8_t* out, size_t count);
+
+// out = x * scale
+void UInt8ToFloat(const uint8_t* x, float scale, float* out, size_t count);
+
+// Reorders channels of `pixels` interleaved pixels: output channel c is input channel order[c]. Must not alias.
+void Swizzle(const uint8_t* in, size_t in_channels, const uint8_t* order, size_t out_channels, size_t element_size,
+             size_t pixels, uint8_t* out);
+
+// Brings `previous` up to date with `in` and tells whether anything differed. Must not alias.
+bool CopyIfChanged(const uint8_t* in, uint8_t* previous, size_t count);
+
+bool HasAvx2();
+
+}
@@ -0,0 +1,423 @@
+#include "tensor_ops.h"
+
+#include <cstring>
+
+#include <nncc/compute/executor.h>
+#include <nncc/compute/tensor_kernels.h>
+
+namespace nncc::compute {
+
+namespace {
+
+// Elements per chunk when splitting a kernel across the compute executor
+constexpr size_t kParallelGrain = 1 << 16;
+
+const TensorView* GetTensor(const Attribute& attribute, DType dtype) {
+    auto* tensor = std::get_if<TensorView>(&attribute.value);
+    if (tensor == nullptr || tensor->Empty() || tensor->dtype != dtype || !tensor->IsContiguous()) {
+        return nullptr;
+    }
+    return tensor;
+}
+
+float GetFloat(const Attribute& attribute) {
+    auto* value = std::get_if<float>(&attribute.value);
+    return value != nullptr ? *value : 0.0f;
+}
+
+Result InvalidInput(const Attribute& input, DType dtype) {
+    return Result{1, fmt::format("Input {} must be a contiguous {} tensor.", input.name, DTypeName(dtype))};
+}
+
+Attribute MakeFloatInput(const nncc::string& name, float value) {
+    Attribute attribute(name, AttributeType::Float);
+    attribute.value = value;
+    return attribute;
+}
+
+// Elements processed per stage of a fused chain before moving on to the next tile, small enough to stay in L1
+constexpr size_t kFusedTile = 2048;
+
+struct FusedStage {
+    enum class Kind {
+        Binary,
+        Clamp,
+        Affine,
+        ToUInt8,
+        ToFloat
+    };
+
+    Kind kind;
+    kernels::BinaryOp op = kernels::BinaryOp::Add;
+    float a = 0.0f, b = 0.0f;
+    const float* other = nullptr;
+};
+
+// Describes a chain node as a stage of the fused loop, or returns false if the chain cannot be fused as it is wired
+bool MakeFusedStage(const ComputeNode& node, const TensorView& head, size_t index, size_t length, FusedStage* stage) {
+    static const std::pair<const char*, kernels::BinaryOp> binary_ops[] = {
+            {"TensorAdd", kernels::BinaryOp::Add},
+            {"TensorSub", kernels::BinaryOp::Sub},
+            {"TensorMul", kernels::BinaryOp::Mul},
+            {"TensorDiv", kernels::BinaryOp::Div},
+    };
+    for (const auto& [type, op]: binary_ops) {
+        if (node.type == type) {
+            auto* other = GetTensor(node.inputs[1], DType::Float32);
+            if (other == nullptr || !other->SameShape(head)) {
+                return false;
+            }
+            *stage = FusedStage{FusedStage::Kind::Binary, op, 0.0f, 0.0f, other->As<float>()};
+            return true;
+        }
+    }
+
+    if (node.type == "TensorClamp") {
+        *stage = FusedStage{FusedStage::Kind::Clamp, {}, GetFloat(node.inputs[1]), GetFloat(node.inputs[2])};
+    } else if (node.type == "TensorNormalize") {
+        *stage = FusedStage{FusedStage::Kind::Affine, {}, GetFloat(node.inputs[1]), GetFloat(node.inputs[2])};
+    } else if (node.type == "TensorToUInt8" && index == length - 1) {
+        *stage = FusedStage{FusedStage::Kind::ToUInt8, {}, GetFloat(node.inputs[1])};
+    } else if (node.type == "TensorToFloat" && index == 0) {
+        *stage = FusedStage{FusedStage::Kind::ToFloat, {}, GetFloat(node.inputs[1])};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Runs a chain the unfused way, handing each intermediate over to the next node
+Result EvaluateChainSequentially(ComputeNode* const* chain, size_t length, entt::registry* registry) {
+    for (size_t i = 0; i < length; ++i) {
+        if (i > 0) {
+            chain[i]->inputs[0].value = chain[i - 1]->outputs[0].value;
+        }
+        auto result = chain[i]->evaluate(chain[i], registry);
+        if (result.code != 0) {
+            return result;
+        }
+    }
+    return Result{0, ""};
+}
+
+// Evaluates a chain of elementwise tensor nodes in one pass over memory. Each tile of the input goes through
+// all stages while it is in cache, and only the last node's output is materialized.
+Result FuseElementwiseChain(ComputeNode* const* chain, size_t length, entt::registry* registry) {
+    const auto head_dtype = chain[0]->type == "TensorToFloat" ? DType::UInt8 : DType::Float32;
+    auto* head = GetTensor(chain[0]->inputs[0], head_dtype);
+    if (head == nullptr) {
+        return InvalidInput(chain[0]->inputs[0], head_dtype);
+    }
+
+    nncc::vector<FusedStage> stages(length);
+    for (size_t i = 0; i < length; ++i) {
+        if (!MakeFusedStage(*chain[i], *head, i, length, &stages[i])) {
+            return EvaluateChainSequentially(chain, length, registry);
+        }
+    }
+
+    const bool to_uint8 = stages.back().kind == FusedStage::Kind::ToUInt8;
+    const auto dtype = to_uint8 ? DType::UInt8 : DType::Float32;
+    auto result = chain[length - 1]->AllocateTensor(dtype, head->shape.data(), head->ndim);
+
+    ParallelFor(head->Numel(), kParallelGrain, [&](size_t begin, size_t end) {
+        float tile[kFusedTile];
+        for (auto offset = begin; offset < end; offset += kFusedTile) {
+            const auto count = std::min(kFusedTile, end - offset);
+            const float* x = head_dtype == DType::Float32 ? head->As<float>() + offset : nullptr;
+
+            for (size_t i = 0; i < length; ++i) {
+                const auto& stage = stages[i];
+                // The last float stage writes straight into the result instead of the tile
+                float* out = !to_uint8 && i == length - 1 ? result.As<float>() + offset : tile;
+                switch (stage.kind) {
+                    case FusedStage::Kind::Binary:
+                        kernels::Binary(stage.op, x, stage.other + offset, out, count);
+                        break;
+                    case FusedStage::Kind::Clamp:
+                        kernels::Clamp(x, stage.a, stage.b, out, count);
+                        break;
+                    case FusedStage::Kind::Affine:
+                        kernels::Affine(x, stage.a, stage.b, out, count);
+                        break;
+                    case FusedStage::Kind::ToFloat:
+                        kernels::UInt8ToFloat(head->As<uint8_t>() + offset, stage.a, out, count);
+                        break;
+                    case FusedStage::Kind::ToUInt8:
+                        kernels::FloatToUInt8(x, stage.a, result.As<uint8_t>() + offset, count);
+                        break;
+                }
+                x = out;
+            }
+        }
+    });
+
+    // Intermediates are never materialized, so absorbed nodes expose no stale tensors
+    for (size_t i = 0; i + 1 < length; ++i) {
+        chain[i]->outputs[0].value = TensorView{};
+    }
+    chain[length - 1]->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+}
+
+template<kernels::BinaryOp op>
+Result TensorBinaryOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* a = GetTensor(node->inputs[0], DType::Float32);
+    auto* b = GetTensor(node->inputs[1], DType::Float32);
+    if (a == nullptr || b == nullptr) {
+        return InvalidInput(node->inputs[a == nullptr ? 0 : 1], DType::Float32);
+    }
+    if (!a->SameShape(*b)) {
+        return Result{1, fmt::format("Shapes differ: {} and {}.", a->Describe(), b->Describe())};
+    }
+
+    auto result = node->AllocateTensor(DType::Float32, a->shape.data(), a->ndim);
+    ParallelFor(a->Numel(), kParallelGrain, [a, b, &result](size_t begin, size_t end) {
+        kernels::Binary(op, a->As<float>() + begin, b->As<float>() + begin, result.As<float>() + begin, end - begin);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorBinaryOp(const nncc::string& name, const nncc::string& type, EvaluateDelegate evaluate) {
+    ComputeNode node;
+
+    node.name = name;
+    node.type = type;
+
+    node.AddInput(Attribute("a", AttributeType::Tensor));
+    node.AddInput(Attribute("b", AttributeType::Tensor));
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate = evaluate;
+    node.fuse.connect<&FuseElementwiseChain>();
+    node.pure = true;
+
+    return node;
+}
+
+ComputeNode MakeTensorAddOp(const void*) {
+    EvaluateDelegate evaluate;
+    evaluate.connect<&TensorBinaryOpEvaluateFn<kernels::BinaryOp::Add>>();
+    return MakeTensorBinaryOp("Tensor Add", "TensorAdd", evaluate);
+}
+
+ComputeNode MakeTensorSubOp(const void*) {
+    EvaluateDelegate evaluate;
+    evaluate.connect<&TensorBinaryOpEvaluateFn<kernels::BinaryOp::Sub>>();
+    return MakeTensorBinaryOp("Tensor Subtract", "TensorSub", evaluate);
+}
+
+ComputeNode MakeTensorMulOp(const void*) {
+    EvaluateDelegate evaluate;
+    evaluate.connect<&TensorBinaryOpEvaluateFn<kernels::BinaryOp::Mul>>();
+    return MakeTensorBinaryOp("Tensor Multiply", "TensorMul", evaluate);
+}
+
+ComputeNode MakeTensorDivOp(const void*) {
+    EvaluateDelegate evaluate;
+    evaluate.connect<&TensorBinaryOpEvaluateFn<kernels::BinaryOp::Div>>();
+    return MakeTensorBinaryOp("Tensor Divide", "TensorDiv", evaluate);
+}
+
+Result TensorClampOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* x = GetTensor(node->inputs[0], DType::Float32);
+    if (x == nullptr) {
+        return InvalidInput(node->inputs[0], DType::Float32);
+    }
+    auto low = GetFloat(node->inputs[1]), high = GetFloat(node->inputs[2]);
+
+    auto result = node->AllocateTensor(DType::Float32, x->shape.data(), x->ndim);
+    ParallelFor(x->Numel(), kParallelGrain, [x, low, high, &result](size_t begin, size_t end) {
+        kernels::Clamp(x->As<float>() + begin, low, high, result.As<float>() + begin, end - begin);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorClampOp(const void*) {
+    ComputeNode node;
+
+    node.name = "Tensor Clamp";
+    node.type = "TensorClamp";
+
+    node.AddInput(Attribute("x", AttributeType::Tensor));
+    node.AddInput(MakeFloatInput("min", 0.0f));
+    node.AddInput(MakeFloatInput("max", 1.0f));
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate.connect<&TensorClampOpEvaluateFn>();
+    node.fuse.connect<&FuseElementwiseChain>();
+    node.pure = true;
+
+    return node;
+}
+
+Result TensorNormalizeOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* x = GetTensor(node->inputs[0], DType::Float32);
+    if (x == nullptr) {
+        return InvalidInput(node->inputs[0], DType::Float32);
+    }
+    auto scale = GetFloat(node->inputs[1]), bias = GetFloat(node->inputs[2]);
+
+    auto result = node->AllocateTensor(DType::Float32, x->shape.data(), x->ndim);
+    ParallelFor(x->Numel(), kParallelGrain, [x, scale, bias, &result](size_t begin, size_t end) {
+        kernels::Affine(x->As<float>() + begin, scale, bias, result.As<float>() + begin, end - begin);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorNormalizeOp(const void*) {
+    ComputeNode node;
+
+    node.name = "Tensor Normalize";
+    node.type = "TensorNormalize";
+
+    node.AddInput(Attribute("x", AttributeType::Tensor));
+    node.AddInput(MakeFloatInput("scale", 1.0f));
+    node.AddInput(MakeFloatInput("bias", 0.0f));
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate.connect<&TensorNormalizeOpEvaluateFn>();
+    node.fuse.connect<&FuseElementwiseChain>();
+    node.pure = true;
+
+    return node;
+}
+
+Result TensorToUInt8OpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* x = GetTensor(node->inputs[0], DType::Float32);
+    if (x == nullptr) {
+        return InvalidInput(node->inputs[0], DType::Float32);
+    }
+    auto scale = GetFloat(node->inputs[1]);
+
+    auto result = node->AllocateTensor(DType::UInt8, x->shape.data(), x->ndim);
+    ParallelFor(x->Numel(), kParallelGrain, [x, scale, &result](size_t begin, size_t end) {
+        kernels::FloatToUInt8(x->As<float>() + begin, scale, result.As<uint8_t>() + begin, end - begin);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorToUInt8Op(const void*) {
+    ComputeNode node;
+
+    node.name = "Tensor To UInt8";
+    node.type = "TensorToUInt8";
+
+    node.AddInput(Attribute("x", AttributeType::Tensor));
+    node.AddInput(MakeFloatInput("scale", 255.0f));
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate.connect<&TensorToUInt8OpEvaluateFn>();
+    node.fuse.connect<&FuseElementwiseChain>();
+    node.pure = true;
+
+    return node;
+}
+
+Result TensorToFloatOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* x = GetTensor(node->inputs[0], DType::UInt8);
+    if (x == nullptr) {
+        return InvalidInput(node->inputs[0], DType::UInt8);
+    }
+    auto scale = GetFloat(node->inputs[1]);
+
+    auto result = node->AllocateTensor(DType::Float32, x->shape.data(), x->ndim);
+    ParallelFor(x->Numel(), kParallelGrain, [x, scale, &result](size_t begin, size_t end) {
+        kernels::UInt8ToFloat(x->As<uint8_t>() + begin, scale, result.As<float>() + begin, end - begin);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorToFloatOp(const void*) {
+    ComputeNode node;
+
+    node.name = "Tensor To Float";
+    node.type = "TensorToFloat";
+
+    node.AddInput(Attribute("x", AttributeType::Tensor));
+    node.AddInput(MakeFloatInput("scale", 1.0f / 255.0f));
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate.connect<&TensorToFloatOpEvaluateFn>();
+    node.fuse.connect<&FuseElementwiseChain>();
+    node.pure = true;
+
+    return node;
+}
+
+Result TensorSwizzleOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
+    auto* x = std::get_if<TensorView>(&node->inputs[0].value);
+    auto* pattern = std::get_if<nncc::string>(&node->inputs[1].value);
+    if (x == nullptr || x->Empty() || !x->IsContiguous() || x->ndim == 0) {
+        return Result{1, "Input x must be a contiguous tensor with channels in the last dimension."};
+    }
+    if (pattern == nullptr || pattern->empty() || pattern->size() > 4) {
+        return Result{1, "Order must be a string of one to four channels, such as \"bgr\"."};
+    }
+
+    // "rgba" name the input channels, so that "bgr" drops alpha and swaps red and blue
+    const nncc::string channel_names = "rgba";
+    const auto in_channels = x->shape[x->ndim - 1];
+    std::array<uint8_t, 4> order{};
+    for (size_t c = 0; c < pattern->size(); ++c) {
+        auto channel = channel_names.find((*pattern)[c]);
+        if (channel == nncc::string::npos || static_cast<int64_t>(channel) >= in_channels) {
+            return Result{1, fmt::format("Channel '{}' is not present in a tensor with {} channels.",
+                                         (*pattern)[c], in_channels)};
+        }
+        order[c] = static_cast<uint8_t>(channel);
+    }
+
+    auto shape = x->shape;
+    shape[x->ndim - 1] = static_cast<int64_t>(pattern->size());
+    auto result = node->AllocateTensor(x->dtype, shape.data(), x->ndim);
+
+    const auto element_size = ElementSize(x->dtype);
+    const auto pixels = static_cast<size_t>(x->Numel() / in_channels);
+    ParallelFor(pixels, kParallelGrain, [&](size_t begin, size_t end) {
+        kernels::Swizzle(x->As<uint8_t>() + begin * in_channels * element_size, in_channels, order.data(),
+                         pattern->size(), element_size, end - begin,
+                         result.As<uint8_t>() + begin * pattern->size() * element_size);
+    });
+
+    node->outputs[0].value = std::move(result);
+    return Result{0, ""};
+}
+
+ComputeNode MakeTensorSwizzleOp(const void*) {
+    ComputeNode node;
+
+    node.name = "Tensor Swizzle";
+    node.type = "TensorSwizzle";
+
+    node.AddInput(Attribute("x", AttributeType::Tensor));
+    Attribute order("order", AttributeType::String);
+    order.value = nncc::string("bgr");
+    node.AddInput(order);
+
+    node.AddOutput(Attribute("result", AttributeType::Tensor));
+
+    node.evaluate.connect<&TensorSwizzleOpEvaluateFn>();
+    node.pure = true;
+
+    return node;
+}
+
+}
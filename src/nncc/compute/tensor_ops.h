@@ -0,0 +1,27 @@
+#pragma once
+
+#include <nncc/compute/graph.h>
+
+namespace nncc::compute {
+
+// Elementwise operations on contiguous tensors, vectorized and split across the compute executor
+
+ComputeNode MakeTensorAddOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorSubOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorMulOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorDivOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorClampOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorNormalizeOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorToUInt8Op(const void* _ = nullptr);
+
+ComputeNode MakeTensorToFloatOp(const void* _ = nullptr);
+
+ComputeNode MakeTensorSwizzleOp(const void* _ = nullptr);
+
+}
@@ -14,6 +14,17 @@ bool Context::InitInMainThread() {
     return true;
 }
 
+bool Context::InitHeadless(uint16_t width, uint16_t height) {
+    windows_.push_back(GLFWWindowWrapper::Offscreen(width, height));
+
+    bgfx::renderFrame();
+    return true;
+}
+
+bool Context::IsHeadless() const {
+    return !windows_.empty() && !windows_[0].ptr;
+}
+
 bool Context::InitWindowing(GLFWerrorfun error_callback) {
     glfwSetErrorCallback(error_callback);
     if (!glfwInit()) {
@@ -116,6 +116,11 @@ public:
 
     bool InitInMainThread();
 
+    // Same as InitInMainThread, but without GLFW: window 0 only describes the offscreen framebuffer rendered into
+    bool InitHeadless(uint16_t width, uint16_t height);
+
+    [[nodiscard]] bool IsHeadless() const;
+
     bool InitWindowing(GLFWerrorfun error_callback);
 
     int16_t CreateWindow(uint16_t width,
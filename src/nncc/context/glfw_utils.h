@@ -39,6 +39,18 @@ using GLFWWindowUniquePtr = std::unique_ptr<GLFWwindow, GLFWWindowDeleter>;
 
 
 struct GLFWWindowWrapper {
+    // Stands in for the window when rendering offscreen, see Context::InitHeadless
+    static GLFWWindowWrapper Offscreen(uint16_t _width, uint16_t _height) {
+        GLFWWindowWrapper window;
+        window.width = _width;
+        window.height = _height;
+        window.framebuffer_width = _width;
+        window.framebuffer_height = _height;
+        window.scale = 1.0f;
+        window.title = "offscreen";
+        return window;
+    }
+
     GLFWWindowWrapper(uint16_t _width, uint16_t _height, nncc::string _title, GLFWmonitor* monitor = nullptr,
                       GLFWwindow* share = nullptr) : title(std::move(_title)), width(_width), height(_height) {
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -67,6 +79,9 @@ struct GLFWWindowWrapper {
     }
 
     void* GetNativeDisplayType() {
+        if (!ptr) {
+            return nullptr;
+        }
 #if BX_PLATFORM_LINUX || BX_PLATFORM_BSD
         return glfwGetX11Display();
 #else
@@ -75,6 +90,9 @@ struct GLFWWindowWrapper {
     }
 
     void* GetNativeHandle() {
+        if (!ptr) {
+            return nullptr;
+        }
 #if BX_PLATFORM_LINUX || BX_PLATFORM_BSD
         return (void*) (uintptr_t) glfwGetX11Window(ptr.get());
 #elif BX_PLATFORM_OSX
@@ -91,6 +109,9 @@ struct GLFWWindowWrapper {
     nncc::string title = "window";
 
     // TODO: do we need to save monitor and share?
+
+private:
+    GLFWWindowWrapper() = default;
 };
 
 
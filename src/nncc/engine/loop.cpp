@@ -1,5 +1,8 @@
 #include "loop.h"
 
+#include <chrono>
+#include <thread>
+
 #include <imnodes/imnodes.h>
 
 #include <imgui_internal.h>
@@ -87,6 +90,54 @@ int Run(ApplicationLoop* loop) {
     thread->shutdown();
     return thread->getExitCode();
 }
+
+int RunHeadless(ApplicationLoop* loop, const HeadlessOptions& options) {
+    auto& context = *nncc::context::Context::Get();
+    if (!context.rendering.UseOffscreen(options.offscreen)) {
+        return 1;
+    }
+    if (!context.InitHeadless(options.offscreen.width, options.offscreen.height)) {
+        return 1;
+    }
+
+    auto thread = context.GetDefaultThread();
+    thread->init(&LoopThreadFunc, static_cast<void*>(loop), 0, "main_loop");
+
+    using Clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.fps > 0 ? 1. / options.fps : 0.));
+    auto next_frame = Clock::now();
+    uint32_t frames = 0;
+    bool exiting = false;
+
+    bool destroyed = false;
+    while (!destroyed) {
+        nncc::context::GlfwMessage message;
+        while (context.GetMessageQueue().read(message)) {
+            if (message.type == nncc::context::GlfwMessageType::Destroy) {
+                destroyed = true;
+            }
+        }
+
+        // The loop thread waits in bgfx::frame until its frame is rendered here, so pacing this thread paces it
+        if (bgfx::renderFrame(100) == bgfx::RenderFrame::Render) {
+            ++frames;
+        }
+        if (options.max_frames != 0 && frames >= options.max_frames && !exiting) {
+            context.Exit();
+            exiting = true;
+        }
+
+        // A late frame does not make the following ones come faster
+        next_frame = std::max(next_frame + period, Clock::now());
+        std::this_thread::sleep_until(next_frame);
+    }
+
+    context.Exit();
+    while (bgfx::renderFrame() != bgfx::RenderFrame::NoContext) {}
+    thread->shutdown();
+    return thread->getExitCode();
+}
 }
 
 //__attribute__((constructor))
@@ -4,6 +4,8 @@
 #include <bx/thread.h>
 #include <entt/entt.hpp>
 
+#include <nncc/rendering/rendering.h>
+
 namespace nncc::engine {
 
 using ApplicationLoop = entt::delegate<int()>;
@@ -12,4 +14,18 @@ int LoopThreadFunc(bx::Thread* self, void* args);
 
 int Run(ApplicationLoop* loop);
 
+struct HeadlessOptions {
+    rendering::OffscreenOptions offscreen;
+
+    // Frames rendered per second, 0 for as fast as the loop submits them
+    double fps = 30;
+
+    // Exits the loop after this many frames, 0 to run until it exits on its own
+    uint32_t max_frames = 0;
+};
+
+// Runs the loop without a window or a display, rendering into an offscreen framebuffer, e.g. to write dashboards
+// from batch jobs on render nodes
+int RunHeadless(ApplicationLoop* loop, const HeadlessOptions& options);
+
 }
@@ -1,30 +1,103 @@
 #include "batch_renderer.h"
 
-#include <optional>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
 
 #include <bgfx/bgfx.h>
 
+#include <nncc/compute/executor.h>
+
 namespace nncc::rendering {
 
+namespace {
+
+// Materials store colours as 0xRRGGBBAA
+std::array<float, 4> DiffuseColor(uint32_t diffuse_color) {
+    float color_a = static_cast<float>(diffuse_color & 0xFF) / 255.0f;
+    float color_b = static_cast<float>(diffuse_color >> 8 & 0xFF) / 255.0f;
+    float color_g = static_cast<float>(diffuse_color >> 16 & 0xFF) / 255.0f;
+    float color_r = static_cast<float>(diffuse_color >> 24 & 0xFF) / 255.0f;
+    return {color_r, color_g, color_b, color_a};
+}
+
+void SetMaterial(bgfx::Encoder* encoder, const Material& material) {
+    auto color = DiffuseColor(material.diffuse_color);
+    encoder->setUniform(material.d_color_uniform, color.data());
+    for (uint8_t i = 0; i < material.parameter_count; ++i) {
+        encoder->setUniform(material.parameter_uniforms[i], material.parameters[i].data());
+    }
+
+    if (material.diffuse_texture.idx != bgfx::kInvalidHandle) {
+        encoder->setTexture(0, material.d_texture_uniform, material.diffuse_texture);
+    }
+}
+
+bool IsTranslucent(uint64_t state) {
+    return (state & BGFX_STATE_BLEND_MASK) != 0;
+}
+
+uint64_t DrawState(uint64_t state, uint64_t vertex_winding_direction) {
+    return (state != 0 ? state : BGFX_STATE_DEFAULT) | vertex_winding_direction;
+}
+
+template<class T>
+T* Append(Buffer<T>* buffer, size_t count) {
+    if (buffer->numel + count > buffer->content.size()) {
+        buffer->content.resize(std::max(buffer->content.size() * 2, buffer->numel + count));
+    }
+    auto* start = buffer->content.data() + buffer->numel;
+    buffer->numel += count;
+    return start;
+}
+
+}
+
 void BatchRenderer::Add(bgfx::ViewId view_id,
                         const Mesh& mesh,
                         const Material& material,
                         const math::Transform& transform,
-                        uint64_t state) {
-    BatchData* batch;
-    BatchId batch_id = {material.shader.idx, material.diffuse_texture.idx};
-    if (!batch_groups_.count(batch_id)) {
-        BatchData batch_data;
-        batch_data.transient_vertex_buffer.content.resize(kMaxTransientVertices);
-        batch_data.transient_index_buffer.content.resize(kMaxTransientIndices);
-        batch_groups_[batch_id] = batch_data;
+                        uint64_t state,
+                        float depth) {
+    if (AddInstance(view_id, mesh, material, transform, state, depth)) {
+        return;
     }
-    batch = &batch_groups_[batch_id];
 
-    // Check if we have enough room in the buffer. If not, flush the buffer to the GPU before adding stuff
-    if (mesh.vertices.size() + batch->transient_vertex_buffer.numel >= kMaxTransientVertices
-        || mesh.vertices.size() + batch->transient_index_buffer.numel >= kMaxTransientIndices) {
-        Flush();
+    // Geometry that does not change every frame is drawn from GPU memory
+    if (mesh.id != 0 && !mesh.dynamic && !mesh.vertices.empty() && !mesh.indices.empty()) {
+        const auto key = RenderQueue::MakeKey(view_id, IsTranslucent(state), material.shader,
+                                              material.diffuse_texture, depth);
+        queue_.Push(key, RenderQueue::Kind::Static, static_cast<uint32_t>(static_commands_.size()));
+        static_commands_.push_back({view_id, state, material, transform, &mesh_buffers_.Get(mesh, state)});
+        return;
+    }
+
+    AddDynamic(view_id, mesh, material, transform, state, depth);
+}
+
+void BatchRenderer::AddDynamic(bgfx::ViewId view_id,
+                               const Mesh& mesh,
+                               const Material& material,
+                               const math::Transform& transform,
+                               uint64_t state,
+                               float depth) {
+    index32_ = (bgfx::getCaps()->supported & BGFX_CAPS_INDEX32) != 0;
+    if (!index32_ && mesh.vertices.size() > kMaxIndex16Vertices) {
+        const auto primitive_vertices = PrimitiveVertices(state);
+        if (primitive_vertices == 0) {
+            if (oversized_strips_.insert(mesh.id).second) {
+                fprintf(stderr, "Mesh %u: strips of more than %u vertices need 32-bit indices\n", mesh.id,
+                        kMaxIndex16Vertices);
+            }
+            return;
+        }
+        for (const auto& part: SplitMesh(mesh, kMaxIndex16Vertices, primitive_vertices)) {
+            AddDynamic(view_id, part, material, transform, state, depth);
+        }
+        return;
     }
 
     // Make sure the batch renderer has been initialized
@@ -33,10 +106,10 @@ void BatchRenderer::Add(bgfx::ViewId view_id,
     // Create new batch command
     BatchCommand command{};
 
-    command.vertex_start_index = batch->transient_vertex_buffer.numel;
+    command.vertex_start_index = dynamic_.staged_vertices.numel;
     command.vertex_count = mesh.vertices.size();
 
-    command.index_start_index = batch->transient_index_buffer.numel;
+    command.index_start_index = dynamic_.staged_indices.numel;
     command.index_count = mesh.indices.size();
 
     command.view_id = view_id;
@@ -45,35 +118,19 @@ void BatchRenderer::Add(bgfx::ViewId view_id,
     command.material = material;
     command.transform = transform;
 
-    // Copy vertex + indices to transient buffer
-    for (auto i = 0; i < command.vertex_count; ++i) {
-        ++batch->transient_vertex_buffer.numel;
-        std::memcpy(&batch->transient_vertex_buffer.content[command.vertex_start_index + i],
-                    &mesh.vertices[i],
-                    sizeof(PosNormUVVertex));
-    }
-
-    int vertex_index_offset = 0;
-    if (!batch->commands.empty() && CanBatch(&batch->commands.front(), &command)) {
-        vertex_index_offset = command.vertex_start_index;
-    }
+    // Stage vertices and indices, the buffers grow as needed
+    std::memcpy(Append(&dynamic_.staged_vertices, command.vertex_count), mesh.vertices.data(),
+                sizeof(PosNormUVVertex) * command.vertex_count);
+    std::memcpy(Append(&dynamic_.staged_indices, command.index_count), mesh.indices.data(),
+                sizeof(uint32_t) * command.index_count);
 
-    for (auto i = 0; i < command.index_count; ++i) {
-        batch->transient_index_buffer.content[batch->transient_index_buffer.numel + i] =
-                mesh.indices[i] + vertex_index_offset;
-    }
-
-    // Push batch command
-    batch->commands.push(command);
+    const auto key = RenderQueue::MakeKey(view_id, IsTranslucent(state), material.shader, material.diffuse_texture,
+                                          depth);
+    queue_.Push(key, RenderQueue::Kind::Dynamic, static_cast<uint32_t>(dynamic_.commands.size()));
+    dynamic_.commands.push_back(command);
 }
 
 void BatchRenderer::Flush() {
-    uint16_t vertex_start = 0;
-    uint16_t vertex_count = 0;
-
-    uint16_t indices_start = 0;
-    uint16_t indices_count = 0;
-
     uint64_t vertex_winding_direction = 0;
     if (type_ == bgfx::RendererType::Noop) {
         type_ = bgfx::getRendererType();
@@ -82,70 +139,294 @@ void BatchRenderer::Flush() {
         vertex_winding_direction = BGFX_STATE_FRONT_CCW;
     }
 
-    bool is_batch = false;
-    for (auto& [batch_id, batch]: batch_groups_) {
-        if (batch.transient_vertex_buffer.numel == 0) {
+    for (uint32_t i = 0; i < frame_instance_batches_.size(); ++i) {
+        const auto& batch = *frame_instance_batches_[i];
+        // Translucent batches are ordered by their farthest instance, opaque ones by their nearest
+        const auto translucent = IsTranslucent(batch.state);
+        const auto key = RenderQueue::MakeKey(batch.view_id, translucent, batch.material.shader,
+                                              batch.material.diffuse_texture,
+                                              translucent ? batch.farthest : batch.nearest);
+        queue_.Push(key, RenderQueue::Kind::Instanced, i);
+    }
+
+    const auto& items = queue_.Sort();
+    if (!dynamic_.commands.empty()) {
+        UploadDynamic(items);
+    }
+    for (auto* batch: frame_instance_batches_) {
+        AllocateInstances(batch);
+    }
+
+    Record(items, vertex_winding_direction);
+
+    // Done! The storage is kept for the next frame.
+    queue_.Clear();
+    static_commands_.clear();
+    for (auto* batch: frame_instance_batches_) {
+        batch->instances.clear();
+        batch->drawn = true;
+    }
+    frame_instance_batches_.clear();
+    ResetBuffers();
+    initialised_ = false;
+}
+
+void BatchRenderer::UploadDynamic(const nncc::vector<RenderQueue::Item>& items) {
+    const BatchCommand* previous = nullptr;
+    for (const auto& item: items) {
+        if (item.kind != RenderQueue::Kind::Dynamic) {
+            previous = nullptr;
             continue;
         }
+        auto& command = dynamic_.commands[item.index];
+
+        // Commands that follow each other in draw order and can be batched share a draw call, as long as its indices
+        // fit
+        command.merged = false;
+        if (previous != nullptr && CanBatch(*previous, command)) {
+            const auto& draw = dynamic_.draws[previous->draw_index];
+            command.merged = index32_ || draw.vertex_count + command.vertex_count <= kMaxIndex16Vertices;
+        }
+        if (!command.merged) {
+            dynamic_.draws.push_back({static_cast<uint32_t>(dynamic_.vertices.numel), 0,
+                                      static_cast<uint32_t>(dynamic_.indices.numel), 0});
+        }
+        command.draw_index = static_cast<uint32_t>(dynamic_.draws.size() - 1);
+        auto& draw = dynamic_.draws.back();
+
+        std::memcpy(Append(&dynamic_.vertices, command.vertex_count),
+                    dynamic_.staged_vertices.content.data() + command.vertex_start_index,
+                    sizeof(PosNormUVVertex) * command.vertex_count);
+
+        // Indices are relative to the first vertex of the draw call
+        auto* indices = Append(&dynamic_.indices, command.index_count);
+        const auto* staged_indices = dynamic_.staged_indices.content.data() + command.index_start_index;
+        for (uint32_t i = 0; i < command.index_count; ++i) {
+            indices[i] = staged_indices[i] + draw.vertex_count;
+        }
 
-        while (!batch.commands.empty()) {
-            BatchCommand command = batch.commands.front();
-            std::optional<BatchCommand> next_command;
+        draw.vertex_count += command.vertex_count;
+        draw.index_count += command.index_count;
+        previous = &command;
+    }
 
-            batch.commands.pop();
+    const auto& vertices = dynamic_.vertices;
+    const auto& indices = dynamic_.indices;
 
-            if (!batch.commands.empty()) {
-                next_command = batch.commands.front();
-            }
+    // bgfx resizes the buffers to whatever is uploaded
+    if (!bgfx::isValid(dynamic_.vertex_buffer)) {
+        dynamic_.vertex_buffer = bgfx::createDynamicVertexBuffer(vertices.numel, PosNormUVVertex::layout,
+                                                                 BGFX_BUFFER_ALLOW_RESIZE);
+        dynamic_.index_buffer = bgfx::createDynamicIndexBuffer(
+                indices.numel, BGFX_BUFFER_ALLOW_RESIZE | (index32_ ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE));
+    }
+    bgfx::update(dynamic_.vertex_buffer, 0,
+                 bgfx::copy(vertices.content.data(), sizeof(PosNormUVVertex) * vertices.numel));
+
+    if (index32_) {
+        bgfx::update(dynamic_.index_buffer, 0, bgfx::copy(indices.content.data(), sizeof(uint32_t) * indices.numel));
+    } else {
+        const auto* memory = bgfx::alloc(sizeof(uint16_t) * indices.numel);
+        auto* indices16 = reinterpret_cast<uint16_t*>(memory->data);
+        for (size_t i = 0; i < indices.numel; ++i) {
+            indices16[i] = static_cast<uint16_t>(indices.content[i]);
+        }
+        bgfx::update(dynamic_.index_buffer, 0, memory);
+    }
+}
+
+void BatchRenderer::AllocateInstances(InstanceBatch* batch) {
+    const uint32_t stride = sizeof(InstanceData);
+    uint32_t allocated = 0;
+    batch->instance_buffers.clear();
+    while (allocated < batch->instances.size()) {
+        const auto count = std::min(static_cast<uint32_t>(batch->instances.size()) - allocated,
+                                    bgfx::getAvailInstanceDataBuffer(batch->instances.size() - allocated, stride));
+        if (count == 0) {
+            break;
+        }
+
+        bgfx::InstanceDataBuffer idb{};
+        bgfx::allocInstanceDataBuffer(&idb, count, stride);
+        std::memcpy(idb.data, batch->instances.data() + allocated, stride * count);
+        batch->instance_buffers.push_back(idb);
+        allocated += count;
+    }
+}
 
-            if (!is_batch) {
-                is_batch = true;
-                vertex_start = command.vertex_start_index;
-                indices_start = command.index_start_index;
-                indices_count = vertex_count = 0;
+void BatchRenderer::Record(const nncc::vector<RenderQueue::Item>& items, uint64_t vertex_winding_direction) {
+    // Each draw is submitted with its position in the queue as its depth. The views are sorted by depth, so bgfx draws
+    // them in queue order whichever encoder recorded them.
+    const auto submit = [&](bgfx::Encoder* encoder, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto& item = items[i];
+            const auto order = static_cast<uint32_t>(i);
+            switch (item.kind) {
+                case RenderQueue::Kind::Static:
+                    SubmitStatic(encoder, static_commands_[item.index], order, vertex_winding_direction);
+                    break;
+                case RenderQueue::Kind::Instanced:
+                    SubmitInstances(encoder, *frame_instance_batches_[item.index], order, vertex_winding_direction);
+                    break;
+                case RenderQueue::Kind::Dynamic:
+                    SubmitDynamic(encoder, dynamic_.commands[item.index], order, vertex_winding_direction);
+                    break;
             }
+        }
+    };
+
+    // The main encoder belongs to this thread, the workers take the rest of them
+    const size_t worker_encoders = std::max<uint16_t>(bgfx::getCaps()->limits.maxEncoders, 1) - 1;
+    const auto grain = std::max(kMinDrawsPerEncoder, items.size() / (worker_encoders + 1) + 1);
+    if (worker_encoders == 0 || items.size() <= grain) {
+        auto* encoder = bgfx::begin();
+        submit(encoder, 0, items.size());
+        bgfx::end(encoder);
+        return;
+    }
+
+    // Chunks that find no free encoder are recorded on this thread afterwards. They are out of turn, but their draws
+    // still carry their place in the queue.
+    const auto api_thread = std::this_thread::get_id();
+    std::mutex deferred_mutex;
+    nncc::vector<std::pair<size_t, size_t>> deferred;
+    compute::ParallelFor(items.size(), grain, [&](size_t begin, size_t end) {
+        auto* encoder = bgfx::begin(std::this_thread::get_id() != api_thread);
+        if (encoder == nullptr) {
+            std::lock_guard lock(deferred_mutex);
+            deferred.emplace_back(begin, end);
+            return;
+        }
+        submit(encoder, begin, end);
+        bgfx::end(encoder);
+    });
+
+    if (!deferred.empty()) {
+        auto* encoder = bgfx::begin();
+        for (const auto& [begin, end]: deferred) {
+            submit(encoder, begin, end);
+        }
+        bgfx::end(encoder);
+    }
+}
+
+void BatchRenderer::SubmitStatic(bgfx::Encoder* encoder, const StaticCommand& command, uint32_t order,
+                                 uint64_t vertex_winding_direction) const {
+    for (const auto& part: *command.parts) {
+        encoder->setVertexBuffer(0, part.vertex_buffer);
+        encoder->setIndexBuffer(part.index_buffer);
+        encoder->setState(DrawState(command.state, vertex_winding_direction));
+
+        SetMaterial(encoder, command.material);
+        encoder->setTransform(*command.transform);
+
+        encoder->submit(command.view_id, command.material.shader, order);
+    }
+}
 
-            vertex_count += command.vertex_count;
-            indices_count += command.index_count;
-
-            // We can no longer batch the command. Send to GPU
-            if (!next_command.has_value() || !CanBatch(&command, &*next_command)) {
-                bgfx::TransientVertexBuffer tvb{};
-                bgfx::allocTransientVertexBuffer(&tvb, vertex_count, PosNormUVVertex::layout);
-                std::memcpy(tvb.data,
-                            batch.transient_vertex_buffer.content.data() + vertex_start,
-                            sizeof(PosNormUVVertex) * vertex_count);
-                auto ibh =
-                        bgfx::createIndexBuffer(
-                                bgfx::makeRef(batch.transient_index_buffer.content.data() + indices_start,
-                                              sizeof(uint16_t) * indices_count));
-
-                bgfx::setVertexBuffer(0, &tvb);
-                bgfx::setIndexBuffer(ibh);
-                bgfx::setState(BGFX_STATE_DEFAULT | vertex_winding_direction);
-
-                float color_a = static_cast<float>(command.material.diffuse_color & 0xFF) / 255.0f;
-                float color_b = static_cast<float>(command.material.diffuse_color >> 8 & 0xFF) / 255.0f;
-                float color_g = static_cast<float>(command.material.diffuse_color >> 16 & 0xFF) / 255.0f;
-                float color_r = static_cast<float>(command.material.diffuse_color >> 24 & 0xFF) / 255.0f;
-                auto color = std::array<float, 4>{color_r, color_g, color_b, color_a};
-                bgfx::setUniform(command.material.d_color_uniform, color.data());
-
-                if (command.material.diffuse_texture.idx != bgfx::kInvalidHandle) {
-                    bgfx::setTexture(0, command.material.d_texture_uniform, command.material.diffuse_texture);
-                }
-                bgfx::setTransform(*command.transform);
-
-                bgfx::submit(command.view_id, command.material.shader);
-                bgfx::destroy(ibh);
-                is_batch = false;
+void BatchRenderer::SubmitInstances(bgfx::Encoder* encoder, const InstanceBatch& batch, uint32_t order,
+                                    uint64_t vertex_winding_direction) const {
+    for (const auto& idb: batch.instance_buffers) {
+        for (const auto& part: *batch.parts) {
+            encoder->setVertexBuffer(0, part.vertex_buffer);
+            encoder->setIndexBuffer(part.index_buffer);
+            encoder->setInstanceDataBuffer(&idb);
+            encoder->setState(DrawState(batch.state, vertex_winding_direction));
+            if (batch.material.diffuse_texture.idx != bgfx::kInvalidHandle) {
+                encoder->setTexture(0, batch.material.d_texture_uniform, batch.material.diffuse_texture);
             }
+            encoder->submit(batch.view_id, batch.material.shader, order);
         }
     }
+}
 
-    // Done!
-    ResetBuffers();
-    initialised_ = false;
+void BatchRenderer::SubmitDynamic(bgfx::Encoder* encoder, const BatchCommand& command, uint32_t order,
+                                  uint64_t vertex_winding_direction) const {
+    if (command.merged) {
+        return;
+    }
+
+    const auto& draw = dynamic_.draws[command.draw_index];
+    encoder->setVertexBuffer(0, dynamic_.vertex_buffer, draw.vertex_start_index, draw.vertex_count);
+    encoder->setIndexBuffer(dynamic_.index_buffer, draw.index_start_index, draw.index_count);
+    encoder->setState(DrawState(command.state, vertex_winding_direction));
+
+    SetMaterial(encoder, command.material);
+    encoder->setTransform(*command.transform);
+
+    encoder->submit(command.view_id, command.material.shader, order);
+}
+
+bool BatchRenderer::AddInstance(bgfx::ViewId view_id,
+                                const Mesh& mesh,
+                                const Material& material,
+                                const math::Transform& transform,
+                                uint64_t state,
+                                float depth) {
+    // Uniforms are per draw call, so materials with parameters are drawn one by one. Tensor planes are: they share
+    // the plane mesh, but each has a texture and tensor shader parameters of its own.
+    if (mesh.id == 0 || mesh.dynamic || material.parameter_count != 0 || mesh.vertices.empty() ||
+        mesh.indices.empty()) {
+        return false;
+    }
+    auto instanced_program = instanced_programs_.find(material.shader.idx);
+    if (instanced_program == instanced_programs_.end()) {
+        return false;
+    }
+
+    InstanceBatchId batch_id = {view_id, material.shader.idx, material.diffuse_texture.idx, mesh.id, mesh.version,
+                                state};
+    auto& batch = instance_batches_[batch_id];
+    if (batch.instances.empty()) {
+        batch.view_id = view_id;
+        batch.state = state;
+        batch.material = material;
+        batch.material.shader = instanced_program->second;
+        batch.parts = &mesh_buffers_.Get(mesh, state);
+        batch.nearest = depth;
+        batch.farthest = depth;
+        frame_instance_batches_.push_back(&batch);
+    }
+    batch.nearest = std::min(batch.nearest, depth);
+    batch.farthest = std::max(batch.farthest, depth);
+    batch.instances.push_back({transform, DiffuseColor(material.diffuse_color)});
+    return true;
+}
+
+void BatchRenderer::EndFrame() {
+    mesh_buffers_.Collect();
+
+    // Batches of meshes that are gone are dropped
+    for (auto it = instance_batches_.begin(); it != instance_batches_.end();) {
+        if (!std::exchange(it->second.drawn, false)) {
+            it = instance_batches_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void BatchRenderer::SetInstancedProgram(bgfx::ProgramHandle program, bgfx::ProgramHandle instanced_program) {
+    if (!bgfx::isValid(program) || !bgfx::isValid(instanced_program) ||
+        (bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) == 0) {
+        return;
+    }
+    instanced_programs_[program.idx] = instanced_program;
+}
+
+void BatchRenderer::Destroy() {
+    if (bgfx::isValid(dynamic_.vertex_buffer)) {
+        bgfx::destroy(dynamic_.vertex_buffer);
+        bgfx::destroy(dynamic_.index_buffer);
+        dynamic_.vertex_buffer = BGFX_INVALID_HANDLE;
+        dynamic_.index_buffer = BGFX_INVALID_HANDLE;
+    }
+    mesh_buffers_.Destroy();
+    queue_.Clear();
+    static_commands_.clear();
+    frame_instance_batches_.clear();
+    instance_batches_.clear();
+    instanced_programs_.clear();
 }
 
 void BatchRenderer::Prepare(bgfx::VertexLayout* vertex_layout) {
@@ -155,24 +436,31 @@ void BatchRenderer::Prepare(bgfx::VertexLayout* vertex_layout) {
     ResetBuffers();
 }
 
-bool BatchRenderer::CanBatch(nncc::rendering::BatchCommand* a, nncc::rendering::BatchCommand* b) {
-    return a->state == b->state;
-}
-
-BatchData* BatchRenderer::GetBatchData(const BatchId& batch_id) {
-    if (batch_groups_.count(batch_id)) {
-        return &batch_groups_[batch_id];
+bool BatchRenderer::CanBatch(const BatchCommand& a, const BatchCommand& b) {
+    const auto& material_a = a.material;
+    const auto& material_b = b.material;
+    if (a.view_id != b.view_id || a.state != b.state || material_a.shader.idx != material_b.shader.idx ||
+        material_a.diffuse_texture.idx != material_b.diffuse_texture.idx ||
+        material_a.diffuse_color != material_b.diffuse_color ||
+        material_a.parameter_count != material_b.parameter_count) {
+        return false;
     }
-
-    auto [map_it, inserted] = batch_groups_.emplace(batch_id, BatchData());
-    return &map_it->second;
+    for (uint8_t i = 0; i < material_a.parameter_count; ++i) {
+        if (material_a.parameter_uniforms[i].idx != material_b.parameter_uniforms[i].idx ||
+            material_a.parameters[i] != material_b.parameters[i]) {
+            return false;
+        }
+    }
+    return std::memcmp(*a.transform, *b.transform, sizeof(float) * 16) == 0;
 }
 
 void BatchRenderer::ResetBuffers() {
-    for (auto& [idx, data]: batch_groups_) {
-        data.transient_vertex_buffer.numel = 0;
-        data.transient_index_buffer.numel = 0;
-    }
+    dynamic_.staged_vertices.numel = 0;
+    dynamic_.staged_indices.numel = 0;
+    dynamic_.commands.clear();
+    dynamic_.vertices.numel = 0;
+    dynamic_.indices.numel = 0;
+    dynamic_.draws.clear();
 }
 
 void BatchRenderer::Init(bgfx::ProgramHandle shader_program) {
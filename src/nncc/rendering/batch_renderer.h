@@ -1,11 +1,14 @@
 #pragma once
 
+#include "mesh_buffer_cache.h"
+#include "render_queue.h"
 #include "surface.h"
 
 #include <array>
 #include <map>
 #include <tuple>
-#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <bgfx/bgfx.h>
 
@@ -14,8 +17,8 @@
 
 namespace nncc::rendering {
 
-const uint16_t kMaxTransientVertices = 0xFFFF;
-const uint16_t kMaxTransientIndices = 0xFFFF;
+// Fewer draws than this are not worth an encoder on another thread
+const size_t kMinDrawsPerEncoder = 256;
 
 // https://stackoverflow.com/questions/52180053/efficient-and-simple-comparison-operators-for-structs
 template<class T>
@@ -40,24 +43,83 @@ struct Buffer {
     size_t numel = 0;
 };
 
+// A mesh whose geometry is uploaded with the frame, see BatchData
 struct BatchCommand {
-    uint16_t vertex_start_index;
-    uint16_t vertex_count;
+    uint32_t vertex_start_index;
+    uint32_t vertex_count;
 
-    uint16_t index_start_index;
-    uint16_t index_count;
+    uint32_t index_start_index;
+    uint32_t index_count;
 
     bgfx::ViewId view_id;
     uint64_t state;
 
     Material material;
     nncc::math::Transform transform;
+
+    // Commands merged into the draw call of an earlier one are not submitted, see BatchRenderer::CanBatch
+    bool merged;
+    uint32_t draw_index;
+};
+
+// Range of the dynamic buffers drawn with one draw call
+struct BatchDraw {
+    uint32_t vertex_start_index;
+    uint32_t vertex_count;
+
+    uint32_t index_start_index;
+    uint32_t index_count;
 };
 
+// Geometry of meshes that are not kept in GPU memory. It is staged as it is added, laid out in draw order once the
+// frame is sorted, and uploaded at once into buffers that grow as needed.
 struct BatchData {
-    Buffer<PosNormUVVertex> transient_vertex_buffer;
-    Buffer<uint16_t> transient_index_buffer;
-    std::queue<BatchCommand> commands;
+    Buffer<PosNormUVVertex> staged_vertices;
+    Buffer<uint32_t> staged_indices;
+    nncc::vector<BatchCommand> commands;
+
+    Buffer<PosNormUVVertex> vertices;
+    Buffer<uint32_t> indices;
+    nncc::vector<BatchDraw> draws;
+
+    bgfx::DynamicVertexBufferHandle vertex_buffer = BGFX_INVALID_HANDLE;
+    bgfx::DynamicIndexBufferHandle index_buffer = BGFX_INVALID_HANDLE;
+};
+
+// Per-instance vertex attributes i_data0 to i_data4, see shaders/default_diffuse/vs_default_diffuse_instanced.sc
+struct InstanceData {
+    math::Transform transform;
+    std::array<float, 4> color;
+};
+
+static_assert(sizeof(InstanceData) == 80);
+
+// Copies of a mesh drawn with one instanced draw call
+struct InstanceBatch {
+    bgfx::ViewId view_id;
+    uint64_t state;
+
+    Material material;
+    const nncc::vector<StaticMesh>* parts = nullptr;
+    nncc::vector<InstanceData> instances;
+    bool drawn = false;
+
+    // Depth range of the instances of the frame, which places the batch in the render queue
+    float nearest = 0.0f;
+    float farthest = 0.0f;
+
+    // The instances copied for the frame, more than one if they do not fit into one buffer
+    nncc::vector<bgfx::InstanceDataBuffer> instance_buffers;
+};
+
+// A mesh drawn from its buffers in GPU memory
+struct StaticCommand {
+    bgfx::ViewId view_id;
+    uint64_t state;
+
+    Material material;
+    nncc::math::Transform transform;
+    const nncc::vector<StaticMesh>* parts;
 };
 
 
@@ -65,37 +127,91 @@ class BatchRenderer {
 public:
     explicit BatchRenderer(const bgfx::RendererType::Enum& type = bgfx::RendererType::Noop) : type_(type) {}
 
+    // `depth` orders draws within their view, which must be in bgfx::ViewMode::DepthAscending, see RenderQueue
     void Add(bgfx::ViewId view_id, const Mesh& mesh, const Material& material, const math::Transform& transform,
-             uint64_t state);
+             uint64_t state, float depth = 0.0f);
 
     void Init(bgfx::ProgramHandle shader_program);
 
     void Flush();
 
+    // Called once per frame, after the last Flush
+    void EndFrame();
+
     void Prepare(bgfx::VertexLayout* vertex_layout);
 
-    struct BatchId {
+    // Meshes with an id drawn with `program` are drawn instanced with `instanced_program` instead, which takes the
+    // transforms and colours from InstanceData
+    void SetInstancedProgram(bgfx::ProgramHandle program, bgfx::ProgramHandle instanced_program);
+
+    void Destroy();
+
+    struct InstanceBatchId {
+        bgfx::ViewId view_id;
         uint16_t shader_idx;
         uint16_t texture_idx;
+        uint32_t mesh_id;
+        uint32_t mesh_version;
+        uint64_t state;
 
         auto AsTuple() const {
-            return std::tie(shader_idx, texture_idx);
+            return std::tie(view_id, shader_idx, texture_idx, mesh_id, mesh_version, state);
         }
     };
 
 private:
     bgfx::RendererType::Enum type_ = bgfx::RendererType::Noop;
     bgfx::VertexLayout* vertex_layout_ = nullptr;
-    std::map<BatchId, BatchData> batch_groups_ = {};
     bool initialised_ = false;
 
-    bgfx::ProgramHandle shader_program_ = BGFX_INVALID_HANDLE;
+    RenderQueue queue_;
+    BatchData dynamic_;
+    nncc::vector<StaticCommand> static_commands_;
+
+    std::unordered_map<uint16_t, bgfx::ProgramHandle> instanced_programs_;
+    std::map<InstanceBatchId, InstanceBatch> instance_batches_;
+    nncc::vector<InstanceBatch*> frame_instance_batches_;
+
+    MeshBufferCache mesh_buffers_;
+
+    bool AddInstance(bgfx::ViewId view_id, const Mesh& mesh, const Material& material, const math::Transform& transform,
+                     uint64_t state, float depth);
 
-    static bool CanBatch(BatchCommand* a, BatchCommand* b);
+    void AddDynamic(bgfx::ViewId view_id, const Mesh& mesh, const Material& material,
+                    const math::Transform& transform, uint64_t state, float depth);
 
-    BatchData* GetBatchData(const BatchId& batch_id);
+    // Lays out the geometry of the dynamic commands in the order they are drawn in, merging what CanBatch allows
+    void UploadDynamic(const nncc::vector<RenderQueue::Item>& items);
+
+    // Instance data is allocated on the API thread, before recording
+    static void AllocateInstances(InstanceBatch* batch);
+
+    // Records the sorted draws with bgfx encoders, in chunks on the compute executor when there are many of them. The
+    // draws carry their position in the queue, which keeps them in order however the chunks are spread over encoders.
+    void Record(const nncc::vector<RenderQueue::Item>& items, uint64_t vertex_winding_direction);
+
+    // `order` is the position of the draw in the sorted queue, submitted as its bgfx depth
+    void SubmitStatic(bgfx::Encoder* encoder, const StaticCommand& command, uint32_t order,
+                      uint64_t vertex_winding_direction) const;
+
+    void SubmitInstances(bgfx::Encoder* encoder, const InstanceBatch& batch, uint32_t order,
+                         uint64_t vertex_winding_direction) const;
+
+    void SubmitDynamic(bgfx::Encoder* encoder, const BatchCommand& command, uint32_t order,
+                       uint64_t vertex_winding_direction) const;
+
+    bgfx::ProgramHandle shader_program_ = BGFX_INVALID_HANDLE;
+
+    // Whether `b` can be drawn with the same draw call as `a`, which needs the same program, texture, state, transform
+    // and uniforms
+    static bool CanBatch(const BatchCommand& a, const BatchCommand& b);
 
     void ResetBuffers();
+
+    bool index32_ = false;
+
+    // Ids of the meshes reported as strips too large to draw, so that each is reported once rather than every frame
+    std::unordered_set<uint32_t> oversized_strips_;
 };
 
 }
\ No newline at end of file
@@ -58,7 +58,12 @@ bgfx::ShaderHandle LoadShader(bx::FileReaderI* reader, const nncc::string& name)
     shader_path << name << ".bin";
     auto path = shader_path.str();
 
-    bgfx::ShaderHandle handle = bgfx::createShader(LoadMemory(reader, path));
+    // Shaders are not compiled for every renderer, e.g. not for Noop, which then draws nothing
+    const auto* memory = LoadMemory(reader, path);
+    if (memory == nullptr) {
+        return BGFX_INVALID_HANDLE;
+    }
+    bgfx::ShaderHandle handle = bgfx::createShader(memory);
     bgfx::setName(handle, name.c_str());
 
     return handle;
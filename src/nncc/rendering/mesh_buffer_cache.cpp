@@ -0,0 +1,75 @@
+#include "mesh_buffer_cache.h"
+
+#include <cstdio>
+
+namespace nncc::rendering {
+
+StaticMesh MeshBufferCache::Upload(const Mesh& mesh, bool index32) {
+    StaticMesh buffers;
+    buffers.vertex_buffer = bgfx::createVertexBuffer(
+            bgfx::copy(mesh.vertices.data(), sizeof(PosNormUVVertex) * mesh.vertices.size()),
+            PosNormUVVertex::layout);
+
+    if (index32) {
+        buffers.index_buffer = bgfx::createIndexBuffer(
+                bgfx::copy(mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size()), BGFX_BUFFER_INDEX32);
+    } else {
+        const auto* memory = bgfx::alloc(sizeof(uint16_t) * mesh.indices.size());
+        auto* indices = reinterpret_cast<uint16_t*>(memory->data);
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            indices[i] = static_cast<uint16_t>(mesh.indices[i]);
+        }
+        buffers.index_buffer = bgfx::createIndexBuffer(memory);
+    }
+    return buffers;
+}
+
+const nncc::vector<StaticMesh>& MeshBufferCache::Get(const Mesh& mesh, uint64_t state) {
+    auto [entry, inserted] = entries_.try_emplace(Key(mesh));
+    entry->second.idle_frames = 0;
+    if (!inserted) {
+        return entry->second.parts;
+    }
+
+    auto& parts = entry->second.parts;
+    if (mesh.vertices.size() <= kMaxIndex16Vertices) {
+        parts.push_back(Upload(mesh, false));
+    } else if ((bgfx::getCaps()->supported & BGFX_CAPS_INDEX32) != 0) {
+        parts.push_back(Upload(mesh, true));
+    } else if (const auto primitive_vertices = PrimitiveVertices(state); primitive_vertices != 0) {
+        for (const auto& part: SplitMesh(mesh, kMaxIndex16Vertices, primitive_vertices)) {
+            parts.push_back(Upload(part, false));
+        }
+    } else {
+        fprintf(stderr, "Mesh %u: strips of more than %u vertices need 32-bit indices\n", mesh.id,
+                kMaxIndex16Vertices);
+    }
+    return parts;
+}
+
+void MeshBufferCache::Collect() {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (++it->second.idle_frames > max_idle_frames_) {
+            Destroy(it->second);
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MeshBufferCache::Destroy() {
+    for (const auto& [key, entry]: entries_) {
+        Destroy(entry);
+    }
+    entries_.clear();
+}
+
+void MeshBufferCache::Destroy(const Entry& entry) {
+    for (const auto& part: entry.parts) {
+        bgfx::destroy(part.vertex_buffer);
+        bgfx::destroy(part.index_buffer);
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <unordered_map>
+
+#include <bgfx/bgfx.h>
+
+#include <nncc/rendering/surface.h>
+
+namespace nncc::rendering {
+
+// Vertices a draw call with 16-bit indices can address
+const uint32_t kMaxIndex16Vertices = 0x10000;
+
+// Geometry of a mesh version in GPU memory
+struct StaticMesh {
+    bgfx::VertexBufferHandle vertex_buffer = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle index_buffer = BGFX_INVALID_HANDLE;
+};
+
+// Keeps static vertex and index buffers of meshes by id and version, so that geometry is uploaded once rather than
+// every frame. A changed mesh comes with a new version and gets new buffers, and buffers no mesh was drawn with for
+// `max_idle_frames` frames are destroyed.
+//
+// Indices are 16-bit where they fit and 32-bit otherwise. Renderers without 32-bit indices get a mesh in parts,
+// each drawn with its own draw call.
+class MeshBufferCache {
+public:
+    explicit MeshBufferCache(uint32_t max_idle_frames = 8) : max_idle_frames_(max_idle_frames) {}
+
+    MeshBufferCache(const MeshBufferCache&) = delete;
+
+    void operator=(const MeshBufferCache&) = delete;
+
+    // Only for meshes with an id. The parts stay valid until the next Collect. A mesh split for a renderer without
+    // 32-bit indices is split by the primitive type of `state` it is first drawn with, a strip too large to draw
+    // has no parts.
+    const nncc::vector<StaticMesh>& Get(const Mesh& mesh, uint64_t state);
+
+    // Called once per frame
+    void Collect();
+
+    void Destroy();
+
+    [[nodiscard]] size_t Size() const {
+        return entries_.size();
+    }
+
+private:
+    struct Entry {
+        nncc::vector<StaticMesh> parts;
+        uint32_t idle_frames = 0;
+    };
+
+    static StaticMesh Upload(const Mesh& mesh, bool index32);
+
+    static void Destroy(const Entry& entry);
+
+    static uint64_t Key(const Mesh& mesh) {
+        return static_cast<uint64_t>(mesh.id) << 32 | mesh.version;
+    }
+
+    uint32_t max_idle_frames_;
+    std::unordered_map<uint64_t, Entry> entries_;
+};
+
+}
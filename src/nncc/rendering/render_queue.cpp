@@ -0,0 +1,70 @@
+#include "render_queue.h"
+
+#include <array>
+#include <bit>
+
+namespace nncc::rendering {
+
+namespace {
+
+constexpr uint64_t kProgramBits = 9;
+constexpr uint64_t kTextureBits = 12;
+constexpr uint64_t kDepthBits = 24;
+
+// The bits of non-negative floats order like the floats themselves
+uint64_t DepthBits(float depth) {
+    if (!(depth > 0.0f)) {
+        return 0;
+    }
+    return std::bit_cast<uint32_t>(depth) >> (32 - kDepthBits);
+}
+
+}
+
+uint64_t RenderQueue::MakeKey(bgfx::ViewId view_id, bool translucent, bgfx::ProgramHandle program,
+                              bgfx::TextureHandle texture, float depth) {
+    const uint64_t program_bits = program.idx & ((1u << kProgramBits) - 1);
+    const uint64_t texture_bits = texture.idx & ((1u << kTextureBits) - 1);
+    const uint64_t depth_bits = DepthBits(depth);
+
+    uint64_t key = static_cast<uint64_t>(view_id & 0xFF) << 56;
+    if (!translucent) {
+        key |= program_bits << 46 | texture_bits << 34 | depth_bits << 10;
+    } else {
+        const uint64_t inverted_depth = ~depth_bits & ((uint64_t(1) << kDepthBits) - 1);
+        key |= uint64_t(1) << 55 | inverted_depth << 31 | program_bits << 22 | texture_bits << 10;
+    }
+    return key;
+}
+
+const nncc::vector<RenderQueue::Item>& RenderQueue::Sort() {
+    // Least significant digit first, one byte at a time, skipping bytes that are the same in all keys
+    std::array<std::array<uint32_t, 256>, 8> counts{};
+    for (const auto& item: items_) {
+        for (size_t digit = 0; digit < 8; ++digit) {
+            ++counts[digit][item.key >> (digit * 8) & 0xFF];
+        }
+    }
+
+    scratch_.resize(items_.size());
+    for (size_t digit = 0; digit < 8; ++digit) {
+        auto& count = counts[digit];
+        if (count[items_.empty() ? 0 : items_[0].key >> (digit * 8) & 0xFF] == items_.size()) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (auto& bucket: count) {
+            const auto size = bucket;
+            bucket = offset;
+            offset += size;
+        }
+        for (const auto& item: items_) {
+            scratch_[count[item.key >> (digit * 8) & 0xFF]++] = item;
+        }
+        items_.swap(scratch_);
+    }
+    return items_;
+}
+
+}
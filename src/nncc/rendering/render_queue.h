@@ -0,0 +1,59 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+
+#include <nncc/common/types.h>
+
+namespace nncc::rendering {
+
+// Draw calls of a frame ordered by a 64-bit sort key, so that draws sharing a program and a texture follow each other
+// and state changes between them are few. Opaque draws of a view come first, sorted by program, texture and then front
+// to back; translucent ones follow back to front. From the most significant bit:
+//
+//   opaque:      view (8) | 0 | program (9) | texture (12) | depth (24) | unused (10)
+//   translucent: view (8) | 1 | inverted depth (24) | program (9) | texture (12) | unused (10)
+//
+// Keys are radix sorted in arrays that are kept between frames, so a frame builds its queue without allocating once
+// the queue has grown to its size.
+//
+// bgfx sorts a view by its own keys, so the order only holds in views set to bgfx::ViewMode::DepthAscending, where
+// draws are submitted with their position in the sorted queue as depth.
+class RenderQueue {
+public:
+    enum class Kind : uint8_t {
+        Static,
+        Instanced,
+        Dynamic
+    };
+
+    struct Item {
+        uint64_t key;
+        uint32_t index;
+        Kind kind;
+    };
+
+    // `depth` is the distance from the camera along the view direction, negative values count as 0
+    static uint64_t MakeKey(bgfx::ViewId view_id, bool translucent, bgfx::ProgramHandle program,
+                            bgfx::TextureHandle texture, float depth);
+
+    // `index` identifies the draw among the ones of its kind
+    void Push(uint64_t key, Kind kind, uint32_t index) {
+        items_.push_back({key, index, kind});
+    }
+
+    const nncc::vector<Item>& Sort();
+
+    void Clear() {
+        items_.clear();
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return items_.size();
+    }
+
+private:
+    nncc::vector<Item> items_;
+    nncc::vector<Item> scratch_;
+};
+
+}
@@ -3,11 +3,19 @@
 namespace nncc::rendering {
 
 void Renderer::Add(const Mesh& mesh, const Material& material, const math::Transform& transform) {
-    batch_renderer_ctx_.Add(view_id_, mesh, material, transform, 0);
+    // Distance of the mesh origin along the view direction, which orders draws within the view
+    float depth = 0.0f;
+    if (view_matrix_.has_value()) {
+        const float* view = **view_matrix_;
+        const float* model = *transform;
+        depth = model[12] * view[2] + model[13] * view[6] + model[14] * view[10] + view[14];
+    }
+    batch_renderer_ctx_.Add(view_id_, mesh, material, transform, 0, depth);
 }
 
 void Renderer::Present() {
     batch_renderer_ctx_.Flush();
+    batch_renderer_ctx_.EndFrame();
 
     view_matrix_.reset();
     projection_matrix_.reset();
@@ -44,7 +52,8 @@ void Renderer::Prepare(bgfx::ProgramHandle program) {
     bx::mtxInverse(*cached_vp_matrix_inv_, *cached_vp_matrix_);
 
     bgfx::setViewTransform(view_id_, **view_matrix_, **projection_matrix_);
-    bgfx::setViewMode(view_id_, bgfx::ViewMode::Default);
+    // The batch renderer submits its draws with their position in its sorted queue as depth
+    bgfx::setViewMode(view_id_, bgfx::ViewMode::DepthAscending);
 
     batch_renderer_ctx_.Prepare(vertex_layout_);
     batch_renderer_ctx_.Init(program);
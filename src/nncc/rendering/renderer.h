@@ -35,6 +35,14 @@ public:
 
     void Prepare(bgfx::ProgramHandle program = BGFX_INVALID_HANDLE);
 
+    void SetInstancedProgram(bgfx::ProgramHandle program, bgfx::ProgramHandle instanced_program) {
+        batch_renderer_ctx_.SetInstancedProgram(program, instanced_program);
+    }
+
+    void Destroy() {
+        batch_renderer_ctx_.Destroy();
+    }
+
 private:
     void Init();
 
@@ -1,9 +1,166 @@
 #include "rendering.h"
 
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <tuple>
+
+#include <fmt/format.h>
+
+#include <nncc/common/image.h>
 #include <nncc/context/context.h>
 
 namespace nncc::rendering {
 
+namespace {
+
+void AssignMeshId(entt::registry& registry, entt::entity entity) {
+    auto& mesh = registry.get<Mesh>(entity);
+    if (mesh.id == 0) {
+        mesh.id = NewMeshId();
+    }
+}
+
+// Meshes edited in place must be patched through the registry to be uploaded again. Entities sharing a mesh id each
+// get a version of their own, as their geometry may now differ.
+void BumpMeshVersion(entt::registry& registry, entt::entity entity) {
+    auto& mesh = registry.get<Mesh>(entity);
+    AssignMeshId(registry, entity);
+    mesh.version = NewMeshVersion();
+}
+
+}
+
+struct RenderingSystem::Offscreen {
+    OffscreenOptions options;
+
+    bgfx::FrameBufferHandle framebuffer = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle color = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle readback = BGFX_INVALID_HANDLE;
+
+    // Filled by the render thread once `available_frame` is reached
+    nncc::vector<uint8_t> pixels;
+    uint32_t captured_frame = 0;
+    uint32_t available_frame = 0;
+    bool pending = false;
+
+    // PNG encoding takes longer than a frame, so it runs aside; frames due while it runs are not captured
+    std::future<void> writing;
+};
+
+bool RenderingSystem::UseOffscreen(const OffscreenOptions& options) {
+    // Checked here rather than on the loop thread, when the first frame is written
+    if (!options.capture_pattern.empty()) {
+        try {
+            std::ignore = fmt::format(fmt::runtime(options.capture_pattern.c_str()), uint32_t{0});
+        } catch (const fmt::format_error& error) {
+            fprintf(stderr, "Invalid capture pattern %s: %s\n", options.capture_pattern.c_str(), error.what());
+            return false;
+        }
+    }
+
+    offscreen_ = std::make_shared<Offscreen>();
+    offscreen_->options = options;
+    return true;
+}
+
+void RenderingSystem::CreateOffscreenFramebuffer() {
+    auto& offscreen = *offscreen_;
+    const auto width = offscreen.options.width, height = offscreen.options.height;
+
+    offscreen.color = bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_RT);
+    const bgfx::TextureHandle attachments[] = {
+            offscreen.color,
+            bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::D32F, BGFX_TEXTURE_RT_WRITE_ONLY),
+    };
+    offscreen.framebuffer = bgfx::createFrameBuffer(BX_COUNTOF(attachments), attachments, true);
+
+    // Views that draw into their own framebuffers, e.g. picking, replace it after this
+    for (bgfx::ViewId view = 0; view < UINT8_MAX; ++view) {
+        bgfx::setViewFrameBuffer(view, offscreen.framebuffer);
+    }
+    bgfx::setViewFrameBuffer(UINT8_MAX, offscreen.framebuffer);
+
+    if (!offscreen.options.capture_pattern.empty() &&
+        (bgfx::getCaps()->supported & BGFX_CAPS_TEXTURE_READ_BACK) != 0) {
+        offscreen.readback = bgfx::createTexture2D(width, height, false, 1, bgfx::TextureFormat::RGBA8,
+                                                   BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK);
+    }
+}
+
+void RenderingSystem::CaptureOffscreen(uint32_t frame_number) {
+    auto& offscreen = *offscreen_;
+    if (!bgfx::isValid(offscreen.readback)) {
+        return;
+    }
+
+    if (offscreen.pending && frame_number >= offscreen.available_frame) {
+        offscreen.pending = false;
+
+        const auto width = offscreen.options.width, height = offscreen.options.height;
+        common::Image image;
+        image.width = width;
+        image.height = height;
+        image.channels = 4;
+        image.buffer = std::move(offscreen.pixels);
+        if (bgfx::getCaps()->originBottomLeft) {
+            const auto stride = static_cast<size_t>(width) * 4;
+            nncc::vector<uint8_t> row(stride);
+            for (uint32_t y = 0; y < height / 2u; ++y) {
+                auto* top = image.buffer.data() + y * stride;
+                auto* bottom = image.buffer.data() + (height - 1 - y) * stride;
+                std::memcpy(row.data(), top, stride);
+                std::memcpy(top, bottom, stride);
+                std::memcpy(bottom, row.data(), stride);
+            }
+        }
+
+        auto filename = fmt::format(fmt::runtime(offscreen.options.capture_pattern.c_str()), offscreen.captured_frame);
+        offscreen.writing = std::async(std::launch::async, [image = std::move(image), filename = std::move(filename)] {
+            if (!common::SaveImage(filename, image)) {
+                fprintf(stderr, "Failed to write frame %s\n", filename.c_str());
+            }
+        });
+    }
+
+    const bool writing = offscreen.writing.valid() &&
+                         offscreen.writing.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    const auto every = std::max(offscreen.options.capture_every, 1u);
+    if (offscreen.pending || writing || frame_number == 0 || frame_number % every != 0) {
+        return;
+    }
+
+    // Blits on the first view run before anything of this frame is drawn, so they copy the frame submitted last
+    offscreen.captured_frame = frame_number - 1;
+    offscreen.pixels.resize(static_cast<size_t>(offscreen.options.width) * offscreen.options.height * 4);
+    bgfx::blit(0, offscreen.readback, 0, 0, offscreen.color);
+    offscreen.available_frame = bgfx::readTexture(offscreen.readback, offscreen.pixels.data());
+    offscreen.pending = true;
+}
+
+void RenderingSystem::Destroy() {
+    if (offscreen_) {
+        if (offscreen_->writing.valid()) {
+            offscreen_->writing.wait();
+        }
+        if (bgfx::isValid(offscreen_->readback)) {
+            bgfx::destroy(offscreen_->readback);
+        }
+        if (bgfx::isValid(offscreen_->framebuffer)) {
+            bgfx::destroy(offscreen_->framebuffer);
+        }
+    }
+
+    renderer_.Destroy();
+
+    auto default_texture = Material::GetDefaultTexture();
+    bgfx::destroy(default_texture);
+    for (const auto& [name, handle]: shader_programs_) {
+        bgfx::destroy(handle);
+    }
+}
+
 void RenderingSystem::Update(nncc::context::Context& context,
                              const nncc::math::Transform& view_matrix,
                              const nncc::math::Transform& projection_matrix,
@@ -15,33 +172,40 @@ void RenderingSystem::Update(nncc::context::Context& context,
     renderer_.SetProjectionMatrix(projection_matrix);
     renderer_.SetViewport({0, 0, static_cast<float>(width), static_cast<float>(height)});
 
+    // Draws are ordered by program and texture when they are presented, see RenderQueue
+    renderer_.Prepare();
     auto view = cregistry.view<Material, Mesh, math::Transform>();
-    std::map<const bgfx::ProgramHandle*, nncc::vector<entt::entity>> entities_by_shader;
     for (auto entity: view) {
         const auto& [material, mesh, transform] = view.get(entity);
-        entities_by_shader[&material.shader].push_back(entity);
-    }
-    for (const auto& [shader, entities]: entities_by_shader) {
-        renderer_.Prepare(*shader);
-
-        for (const auto& entity: entities) {
-            const auto& [material, mesh, transform] = view.get(entity);
-            renderer_.Add(mesh, material, transform);
-        }
+        renderer_.Add(mesh, material, transform);
     }
 
     renderer_.Present();
+
+    if (offscreen_) {
+        CaptureOffscreen(context.frame_number);
+    }
 }
 
-int RenderingSystem::Init(uint16_t width, uint16_t height) {
+int RenderingSystem::Init(uint16_t width, uint16_t height, bgfx::RendererType::Enum renderer) {
     rendering::PosNormUVVertex::Init();
 
-    auto& context = *context::Context::Get();
-    auto& window = context.GetWindow(0);
+    auto& registry = context::Context::Get()->registry;
+    registry.on_construct<Mesh>().connect<&AssignMeshId>();
+    registry.on_update<Mesh>().connect<&BumpMeshVersion>();
+
+    if (offscreen_ && renderer == bgfx::RendererType::Count) {
+        renderer = offscreen_->options.renderer;
+    }
 
     bgfx::Init init;
-    init.platformData.ndt = window.GetNativeDisplayType();
-    init.platformData.nwh = window.GetNativeHandle();
+    init.type = renderer;
+    // Without a window handle, e.g. when offscreen, bgfx creates a context that only renders into framebuffers
+    if (renderer != bgfx::RendererType::Noop) {
+        auto& window = context::Context::Get()->GetWindow(0);
+        init.platformData.ndt = window.GetNativeDisplayType();
+        init.platformData.nwh = window.GetNativeHandle();
+    }
     init.resolution.width = (uint32_t) width;
     init.resolution.height = (uint32_t) height;
     init.resolution.reset = BGFX_RESET_VSYNC;
@@ -49,6 +213,10 @@ int RenderingSystem::Init(uint16_t width, uint16_t height) {
         return 1;
     }
 
+    if (offscreen_ && bgfx::getRendererType() != bgfx::RendererType::Noop) {
+        CreateOffscreenFramebuffer();
+    }
+
     bgfx::setViewClear(0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0x303030ff, 1.0f, 0);
     bgfx::setViewRect(0, 0, 0, width, height);
 
@@ -58,6 +226,20 @@ int RenderingSystem::Init(uint16_t width, uint16_t height) {
     auto program = bgfx::createProgram(vs, fs, true);
     shader_programs_["default_diffuse"] = program;
 
+    // Copies of a mesh drawn with the default shader become one instanced draw call, see BatchRenderer
+    shader_programs_["default_diffuse_instanced"] = bgfx::createProgram(
+            nncc::engine::LoadShader(&reader, "vs_default_diffuse_instanced"),
+            nncc::engine::LoadShader(&reader, "fs_default_diffuse_instanced"),
+            true);
+    renderer_.SetInstancedProgram(program, shader_programs_["default_diffuse_instanced"]);
+
+    // Tensors shown from their raw elements share the vertex shader, see shaders/tensor_image
+    for (const char* name: {"tensor_float", "tensor_bfloat16", "tensor_labels"}) {
+        shader_programs_[name] = bgfx::createProgram(nncc::engine::LoadShader(&reader, "vs_default_diffuse"),
+                                                     nncc::engine::LoadShader(&reader, nncc::string("fs_") + name),
+                                                     true);
+    }
+
     return 0;
 }
 
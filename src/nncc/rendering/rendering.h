@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 
 #include <nncc/math/types.h>
@@ -15,25 +16,44 @@ class Context;
 
 namespace nncc::rendering {
 
+// Rendering into a framebuffer instead of a window, see engine::RunHeadless
+struct OffscreenOptions {
+    uint16_t width = 1600, height = 1000;
+
+    // A renderer that can run without a window, e.g. Vulkan on lavapipe or OpenGL on EGL. Noop renders nothing, so
+    // nothing is captured.
+    bgfx::RendererType::Enum renderer = bgfx::RendererType::Count;
+
+    // fmt pattern of the PNG files frames are written to, given the frame number, e.g. "frames/{:06}.png". Empty to
+    // capture nothing.
+    nncc::string capture_pattern;
+    uint32_t capture_every = 1;
+};
+
 class RenderingSystem {
 public:
-    int Init(uint16_t width, uint16_t height);
+    // Called before Init. Fails for a capture pattern fmt cannot format a frame number with.
+    bool UseOffscreen(const OffscreenOptions& options);
+
+    // The Noop renderer needs no window, e.g. for benchmarks on machines without a GPU
+    int Init(uint16_t width, uint16_t height, bgfx::RendererType::Enum renderer = bgfx::RendererType::Count);
 
     void Update(context::Context& context, const math::Transform& view_matrix, const math::Transform& projection_matrix,
                 uint16_t width, uint16_t height);
 
-    void Destroy() {
-        auto default_texture = Material::GetDefaultTexture();
-        bgfx::destroy(default_texture);
-        for (const auto& [name, handle]: shader_programs_) {
-            bgfx::destroy(handle);
-        }
-    }
+    void Destroy();
 
     std::unordered_map<nncc::string, bgfx::ProgramHandle> shader_programs_;
 
 private:
+    struct Offscreen;
+
+    void CreateOffscreenFramebuffer();
+
+    void CaptureOffscreen(uint32_t frame_number);
+
     rendering::Renderer renderer_{};
+    std::shared_ptr<Offscreen> offscreen_;
 };
 
 }
\ No newline at end of file
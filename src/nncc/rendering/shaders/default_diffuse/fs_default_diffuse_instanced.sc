@@ -0,0 +1,9 @@
+$input v_pos, v_view, v_normal, v_texcoord0, v_color0
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(diffuseTX, 0);
+
+void main() {
+    gl_FragColor = vec4(v_color0.rgb * texture2D(diffuseTX, v_texcoord0).rgb, 1);
+}
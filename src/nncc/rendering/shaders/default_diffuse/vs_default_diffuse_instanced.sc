@@ -0,0 +1,15 @@
+$input a_position, a_normal, a_texcoord0, i_data0, i_data1, i_data2, i_data3, i_data4
+$output v_pos, v_view, v_normal, v_texcoord0, v_color0
+
+#include <bgfx_shader.sh>
+
+// vs_default_diffuse with the model transform and the diffuse colour per instance, see InstanceData
+void main() {
+    mat4 model = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    vec4 world = mul(model, vec4(a_position, 1.0));
+    gl_Position = mul(u_viewProj, world);
+    v_pos = mul(u_view, world).xyz;
+    v_normal = mul(u_view, mul(model, vec4(a_normal, 0.0))).xyz;
+    v_texcoord0 = a_texcoord0;
+    v_color0 = i_data4;
+}
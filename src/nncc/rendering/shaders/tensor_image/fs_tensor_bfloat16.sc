@@ -0,0 +1,29 @@
+$input v_pos, v_view, v_normal, v_texcoord0
+
+#include <bgfx_shader.sh>
+#include "tensor_image.sh"
+
+// bfloat16 elements, which are the upper halves of float32 ones
+USAMPLER2D(diffuseTX, 0);
+
+float fetchElement(ivec2 texel) {
+    return uintBitsToFloat(texelFetch(diffuseTX, texel, 0).x << 16u);
+}
+
+void main() {
+    ivec3 pixel = tensorPixel(v_texcoord0);
+    if (pixel.z < 0) {
+        gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec4 value = vec4(0.0, 0.0, 0.0, 1.0);
+    value.x = fetchElement(tensorTexel(pixel, 0));
+    if (u_channels > 1) {
+        value.y = fetchElement(tensorTexel(pixel, 1));
+    }
+    if (u_channels > 2) {
+        value.z = fetchElement(tensorTexel(pixel, 2));
+    }
+    gl_FragColor = tensorColor(value);
+}
@@ -0,0 +1,25 @@
+$input v_pos, v_view, v_normal, v_texcoord0
+
+#include <bgfx_shader.sh>
+#include "tensor_image.sh"
+
+// uint8 (normalized), float16 and float32 elements
+SAMPLER2D(diffuseTX, 0);
+
+void main() {
+    ivec3 pixel = tensorPixel(v_texcoord0);
+    if (pixel.z < 0) {
+        gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec4 value = vec4(0.0, 0.0, 0.0, 1.0);
+    value.x = texelFetch(diffuseTX, tensorTexel(pixel, 0), 0).x;
+    if (u_channels > 1) {
+        value.y = texelFetch(diffuseTX, tensorTexel(pixel, 1), 0).x;
+    }
+    if (u_channels > 2) {
+        value.z = texelFetch(diffuseTX, tensorTexel(pixel, 2), 0).x;
+    }
+    gl_FragColor = tensorColor(value);
+}
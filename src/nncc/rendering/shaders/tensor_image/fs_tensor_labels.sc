@@ -0,0 +1,28 @@
+$input v_pos, v_view, v_normal, v_texcoord0
+
+#include <bgfx_shader.sh>
+#include "tensor_image.sh"
+
+// int32 label maps, one distinct colour per label
+ISAMPLER2D(diffuseTX, 0);
+
+vec3 labelColor(int label) {
+    if (label == 0) {
+        return vec3(0.0, 0.0, 0.0);
+    }
+    // Golden ratio steps of the hue keep neighbouring labels apart
+    float hue = fract(float(label) * 0.618034);
+    vec3 rgb = clamp(abs(fract(hue + vec3(0.0, 2.0 / 3.0, 1.0 / 3.0)) * 6.0 - 3.0) - 1.0, 0.0, 1.0);
+    return mix(vec3(0.35, 0.35, 0.35), rgb, 0.85);
+}
+
+void main() {
+    ivec3 pixel = tensorPixel(v_texcoord0);
+    if (pixel.z < 0) {
+        gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    int label = texelFetch(diffuseTX, tensorTexel(pixel, 0), 0).x;
+    gl_FragColor = vec4(diffuseCol.rgb * labelColor(label), 1.0);
+}
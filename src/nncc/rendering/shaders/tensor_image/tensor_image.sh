@@ -0,0 +1,57 @@
+// Tensors uploaded as single-channel textures of their elements, see TensorImage in pynncc/torch/tensor_registry.h.
+// Batched tensors are shown as a grid of images.
+
+uniform vec4 tensorShape;   // width, height, channels, batch
+uniform vec4 tensorLayout;  // planar (CHW) rather than interleaved (HWC), grid columns, colormap
+uniform vec4 tensorRange;   // scale and bias applied to every element
+uniform vec4 diffuseCol;
+
+#define u_width    int(tensorShape.x)
+#define u_height   int(tensorShape.y)
+#define u_channels int(tensorShape.z)
+#define u_batch    int(tensorShape.w)
+#define u_planar   (tensorLayout.x > 0.5)
+#define u_columns  int(tensorLayout.y)
+#define u_colormap (tensorLayout.z > 0.5)
+
+// Image of the batch and pixel under a texture coordinate, image -1 between the last image and the end of the grid
+ivec3 tensorPixel(vec2 texcoord) {
+    int rows = (u_batch + u_columns - 1) / u_columns;
+    vec2 grid = texcoord * vec2(float(u_columns), float(rows));
+    ivec2 tile = ivec2(floor(grid));
+    int image = tile.y * u_columns + tile.x;
+    ivec2 pixel = min(ivec2(fract(grid) * tensorShape.xy), ivec2(u_width - 1, u_height - 1));
+    return ivec3(pixel, image < u_batch ? image : -1);
+}
+
+ivec2 tensorTexel(ivec3 pixel, int channel) {
+    if (u_planar) {
+        return ivec2(pixel.x, (pixel.z * u_channels + channel) * u_height + pixel.y);
+    }
+    return ivec2(pixel.x * u_channels + channel, pixel.z * u_height + pixel.y);
+}
+
+// Polynomial fit of matplotlib's viridis
+vec3 viridis(float t) {
+    t = clamp(t, 0.0, 1.0);
+    vec3 c0 = vec3(0.2777, 0.0054, 0.3341);
+    vec3 c1 = vec3(0.1051, 1.4046, 1.3846);
+    vec3 c2 = vec3(-0.3309, 0.2148, 0.0951);
+    vec3 c3 = vec3(-4.6342, -5.7991, -19.3324);
+    vec3 c4 = vec3(6.2283, 14.1799, 56.6906);
+    vec3 c5 = vec3(4.7764, -13.7451, -65.3530);
+    vec3 c6 = vec3(-5.4355, 4.6459, 26.3124);
+    return c0 + t * (c1 + t * (c2 + t * (c3 + t * (c4 + t * (c5 + t * c6)))));
+}
+
+// Up to four scaled elements of a pixel as a colour
+vec4 tensorColor(vec4 value) {
+    value = value * tensorRange.x + tensorRange.y;
+    vec3 color = value.rgb;
+    if (u_channels == 1) {
+        color = u_colormap ? viridis(value.x) : value.xxx;
+    } else if (u_channels == 2) {
+        color = vec3(value.xy, 0.0);
+    }
+    return vec4(diffuseCol.rgb * color, 1.0);
+}
@@ -1,5 +1,8 @@
 #include "surface.h"
 
+#include <atomic>
+#include <stdexcept>
+
 namespace nncc::rendering {
 
 bgfx::VertexLayout PosNormUVVertex::layout;
@@ -15,8 +18,76 @@ void PosNormUVVertex::Init() {
 
 bgfx::TextureHandle Material::default_texture = BGFX_INVALID_HANDLE;
 
+uint32_t NewMeshId() {
+    static std::atomic<uint32_t> last_id = 0;
+    return ++last_id;
+}
+
+uint32_t NewMeshVersion() {
+    static std::atomic<uint32_t> last_version = 0;
+    return ++last_version;
+}
+
+uint32_t PrimitiveVertices(uint64_t state) {
+    switch (state & BGFX_STATE_PT_MASK) {
+        case BGFX_STATE_PT_LINES:
+            return 2;
+        case BGFX_STATE_PT_POINTS:
+            return 1;
+        case BGFX_STATE_PT_TRISTRIP:
+        case BGFX_STATE_PT_LINESTRIP:
+            return 0;
+        default:
+            return 3;
+    }
+}
+
+nncc::vector<Mesh> SplitMesh(const Mesh& mesh, uint32_t max_vertices, uint32_t primitive_vertices) {
+    if (primitive_vertices == 0 || primitive_vertices > 3) {
+        throw std::invalid_argument("Only lists of triangles, lines or points can be split.");
+    }
+    nncc::vector<Mesh> parts(1);
+
+    // Index of every vertex of the mesh in the current part, or UINT32_MAX
+    nncc::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+    nncc::vector<uint32_t> remapped;
+    for (size_t primitive = 0; primitive + primitive_vertices <= mesh.indices.size();
+         primitive += primitive_vertices) {
+        uint32_t missing = 0;
+        for (size_t i = primitive; i < primitive + primitive_vertices; ++i) {
+            missing += remap[mesh.indices[i]] == UINT32_MAX;
+        }
+        if (parts.back().vertices.size() + missing > max_vertices) {
+            for (auto vertex: remapped) {
+                remap[vertex] = UINT32_MAX;
+            }
+            remapped.clear();
+            parts.emplace_back();
+        }
+
+        auto& part = parts.back();
+        for (size_t i = primitive; i < primitive + primitive_vertices; ++i) {
+            const auto vertex = mesh.indices[i];
+            if (remap[vertex] == UINT32_MAX) {
+                remap[vertex] = static_cast<uint32_t>(part.vertices.size());
+                remapped.push_back(vertex);
+                part.vertices.push_back(mesh.vertices[vertex]);
+            }
+            part.indices.push_back(remap[vertex]);
+        }
+    }
+
+    for (auto& part: parts) {
+        part.dynamic = mesh.dynamic;
+    }
+    return parts;
+}
+
 Mesh GetPlaneMesh() {
+    static const uint32_t plane_mesh_id = NewMeshId();
+
     Mesh mesh;
+    mesh.id = plane_mesh_id;
     mesh.vertices = {
             {{-1.0f, 1.0f,  0.05f},  {0., 0., 1.},  0., 0.},
             {{1.0f,  1.0f,  0.05f},  {0., 0., 1.},  1., 0.},
@@ -30,14 +30,40 @@ struct PosNormUVVertex {
 
 template<class T>
 using VertexBuffer = nncc::vector<T>;
-using VertexBufferIndices = nncc::vector<uint16_t>;
+using VertexBufferIndices = nncc::vector<uint32_t>;
 
 struct Mesh {
 public:
     VertexBuffer<PosNormUVVertex> vertices;
     VertexBufferIndices indices;
+
+    // Meshes with the same nonzero id and version share their geometry, which stays in GPU memory and lets copies of
+    // them be drawn instanced. Meshes added to the registry get an id, and a new version whenever they are replaced or
+    // patched, see RenderingSystem::Init. Versions are unique across all meshes, so that copies of a mesh that are
+    // patched separately part ways. Meshes without an id are uploaded every frame.
+    //
+    // Copies are only batched if they also share their shader, texture and state, and their material has no
+    // parameters. Tensor planes all use the plane mesh, but each has its own texture and tensor shader parameters, so
+    // they are drawn one call per plane, from the plane's buffers in GPU memory.
+    uint32_t id = 0;
+    uint32_t version = 0;
+
+    // Geometry that changes every frame, which is uploaded every frame instead of being kept in GPU memory
+    bool dynamic = false;
 };
 
+uint32_t NewMeshId();
+
+uint32_t NewMeshVersion();
+
+// Vertices per primitive drawn with a bgfx state: 3 for triangle lists, 2 for line lists, 1 for points, and 0 for
+// strips, whose primitives share vertices
+uint32_t PrimitiveVertices(uint64_t state);
+
+// Splits a mesh into parts of at most `max_vertices` vertices each, for renderers without 32-bit indices. Primitives
+// of `primitive_vertices` indices each are kept whole and in order. Strips cannot be split and throw.
+nncc::vector<Mesh> SplitMesh(const Mesh& mesh, uint32_t max_vertices, uint32_t primitive_vertices = 3);
+
 
 struct Material {
     bgfx::ProgramHandle shader;
@@ -46,6 +72,12 @@ struct Material {
     bgfx::TextureHandle diffuse_texture = Material::GetDefaultTexture();
     bgfx::UniformHandle d_color_uniform, d_texture_uniform;
 
+    // Further vec4 uniforms of the shader
+    static constexpr size_t kMaxParameters = 4;
+    std::array<bgfx::UniformHandle, kMaxParameters> parameter_uniforms{};
+    std::array<std::array<float, 4>, kMaxParameters> parameters{};
+    uint8_t parameter_count = 0;
+
     static bgfx::TextureHandle GetDefaultTexture() {
         if (default_texture.idx == bgfx::kInvalidHandle) {
             auto texture_memory = bgfx::makeRef(white.data(), sizeof(uint8_t) * 4);
@@ -0,0 +1,377 @@
+#include "texture_uploader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <nncc/compute/tensor_kernels.h>
+
+namespace nncc::rendering {
+
+struct TextureUploader::StagingBuffer {
+    explicit StagingBuffer(size_t _capacity) : data(new uint8_t[_capacity]), capacity(_capacity) {}
+
+    std::unique_ptr<uint8_t[]> data;
+    size_t capacity;
+
+    // One held by the uploader for as long as it exists, plus one per bgfx memory reference not yet released. The
+    // buffer is free when only the uploader holds it, and deleted by whoever drops the last reference.
+    std::atomic<uint32_t> references = 1;
+};
+
+namespace {
+
+void ReleaseOwner(void*, void* user_data) {
+    delete static_cast<std::shared_ptr<void>*>(user_data);
+}
+
+TextureRegion BoundingBox(const nncc::vector<TextureRegion>& regions) {
+    uint16_t left = UINT16_MAX, top = UINT16_MAX, right = 0, bottom = 0;
+    for (const auto& region: regions) {
+        left = std::min(left, region.x);
+        top = std::min(top, region.y);
+        right = std::max<uint16_t>(right, region.x + region.width);
+        bottom = std::max<uint16_t>(bottom, region.y + region.height);
+    }
+    return {left, top, static_cast<uint16_t>(right - left), static_cast<uint16_t>(bottom - top)};
+}
+
+// Clips regions to the texture and drops empty ones
+void ClipRegions(nncc::vector<TextureRegion>* regions, uint16_t width, uint16_t height) {
+    auto empty = std::remove_if(regions->begin(), regions->end(), [width, height](TextureRegion& region) {
+        region.width = std::min<uint16_t>(region.width, region.x < width ? width - region.x : 0);
+        region.height = std::min<uint16_t>(region.height, region.y < height ? height - region.y : 0);
+        return region.width == 0 || region.height == 0;
+    });
+    regions->erase(empty, regions->end());
+}
+
+}
+
+nncc::vector<TextureRegion> DiffTextureRegions(const uint8_t* image, uint8_t* previous, uint16_t width,
+                                               uint16_t height, size_t pixel_bytes, uint16_t block,
+                                               size_t max_regions) {
+    const size_t pitch = width * pixel_bytes;
+    const size_t blocks = (width + block - 1) / block;
+
+    nncc::vector<TextureRegion> regions;
+    // Regions that reach the block row above, which a run of the same columns extends downwards
+    nncc::vector<size_t> open, still_open;
+    nncc::vector<uint8_t> dirty(blocks);
+
+    for (uint32_t top = 0; top < height; top += block) {
+        const auto rows = static_cast<uint16_t>(std::min<uint32_t>(block, height - top));
+        std::fill(dirty.begin(), dirty.end(), 0);
+
+        for (auto row = top; row < top + rows; ++row) {
+            for (size_t column = 0; column < blocks; ++column) {
+                const auto offset = row * pitch + column * block * pixel_bytes;
+                const auto bytes = std::min<size_t>(block * pixel_bytes, pitch - column * block * pixel_bytes);
+                if (dirty[column]) {
+                    std::memcpy(previous + offset, image + offset, bytes);
+                } else {
+                    dirty[column] = compute::kernels::CopyIfChanged(image + offset, previous + offset, bytes);
+                }
+            }
+        }
+
+        still_open.clear();
+        for (size_t begin = 0; begin < blocks;) {
+            if (!dirty[begin]) {
+                ++begin;
+                continue;
+            }
+            auto end = begin;
+            while (end < blocks && dirty[end]) {
+                ++end;
+            }
+
+            const auto x = static_cast<uint16_t>(begin * block);
+            const auto run_width = static_cast<uint16_t>(std::min<size_t>(end * block, width) - x);
+            auto above = std::find_if(open.begin(), open.end(), [&](size_t index) {
+                return regions[index].x == x && regions[index].width == run_width;
+            });
+            if (above != open.end()) {
+                regions[*above].height += rows;
+                still_open.push_back(*above);
+            } else {
+                still_open.push_back(regions.size());
+                regions.push_back({x, static_cast<uint16_t>(top), run_width, rows});
+            }
+            begin = end;
+        }
+        std::swap(open, still_open);
+    }
+
+    if (regions.size() > max_regions) {
+        regions = {BoundingBox(regions)};
+    }
+    return regions;
+}
+
+size_t TextureUploader::Upload::RegionBytes() const {
+    if (regions.empty()) {
+        return bytes;
+    }
+    const auto pixel_bytes = Pitch() / width;
+    size_t total = 0;
+    for (const auto& region: regions) {
+        total += static_cast<size_t>(region.width) * region.height * pixel_bytes;
+    }
+    return total;
+}
+
+TextureUploader::TextureUploader(size_t frame_budget, size_t max_staging)
+        : frame_budget_(frame_budget), max_staging_(max_staging) {}
+
+void TextureUploader::ReleaseStaging(void*, void* user_data) {
+    auto* buffer = static_cast<StagingBuffer*>(user_data);
+    if (buffer->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete buffer;
+    }
+}
+
+TextureUploader::~TextureUploader() {
+    for (auto* buffer: staging_) {
+        ReleaseStaging(nullptr, buffer);
+    }
+}
+
+void TextureUploader::Request(bgfx::TextureHandle texture, uint16_t width, uint16_t height, const void* data,
+                              size_t bytes, std::shared_ptr<void> owner, bool producer_may_mutate,
+                              nncc::vector<TextureRegion> regions, const std::atomic<uint32_t>* sequence,
+                              uint64_t group) {
+    ClipRegions(&regions, width, height);
+    const bool whole = regions.empty() ||
+                       (regions.size() == 1 && regions[0].width == width && regions[0].height == height);
+    if (whole) {
+        regions.clear();
+    }
+
+    // The latest request wins but keeps the place of the first one, so that a busy texture cannot starve others
+    if (auto found = pending_by_texture_.find(texture.idx); found != pending_by_texture_.end()) {
+        auto& pending = pending_[found->second];
+        if (whole || pending.regions.empty() || pending.width != width || pending.height != height) {
+            regions.clear();
+        } else {
+            regions.insert(regions.begin(), pending.regions.begin(), pending.regions.end());
+            if (regions.size() > kMaxRegions) {
+                regions = {BoundingBox(regions)};
+            }
+        }
+        pending = Upload{texture, width, height, data, bytes, std::move(owner), producer_may_mutate,
+                         std::move(regions), sequence, group};
+        ++coalesced_;
+        return;
+    }
+    pending_by_texture_[texture.idx] = pending_.size();
+    pending_.push_back(Upload{texture, width, height, data, bytes, std::move(owner), producer_may_mutate,
+                              std::move(regions), sequence, group});
+}
+
+void TextureUploader::Cancel(bgfx::TextureHandle texture) {
+    auto found = pending_by_texture_.find(texture.idx);
+    if (found == pending_by_texture_.end()) {
+        return;
+    }
+
+    pending_.erase(pending_.begin() + static_cast<ptrdiff_t>(found->second));
+    pending_by_texture_.clear();
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        pending_by_texture_[pending_[i].texture.idx] = i;
+    }
+}
+
+void TextureUploader::Flush() {
+    stats_ = Stats{};
+    stats_.coalesced = coalesced_;
+    coalesced_ = 0;
+
+    // Uploads left waiting are deferred, torn ones overlapped a write of the producer and are taken again next frame
+    enum class Outcome : uint8_t {
+        Waiting, Submitted, Torn
+    };
+    nncc::vector<Outcome> outcomes(pending_.size(), Outcome::Waiting);
+    nncc::vector<size_t> members;
+    nncc::vector<const uint8_t*> staged;
+
+    for (size_t first = 0; first < pending_.size(); ++first) {
+        if (outcomes[first] != Outcome::Waiting) {
+            continue;
+        }
+
+        members.assign(1, first);
+        if (pending_[first].group != 0) {
+            for (auto i = first + 1; i < pending_.size(); ++i) {
+                if (pending_[i].group == pending_[first].group) {
+                    members.push_back(i);
+                }
+            }
+        }
+
+        size_t group_bytes = 0, staging_bytes = 0;
+        for (auto i: members) {
+            auto& upload = pending_[i];
+            if (upload.regions.empty()) {
+                upload.regions.push_back({0, 0, upload.width, upload.height});
+            }
+            group_bytes += upload.RegionBytes();
+            staging_bytes += upload.NeedsStaging() ? upload.RegionBytes() : 0;
+        }
+        if (stats_.bytes > 0 && stats_.bytes + group_bytes > frame_budget_) {
+            break;
+        }
+
+        // The whole group is copied before any of it is submitted, so that one torn copy holds all of it back
+        StagingBuffer* staging = nullptr;
+        if (staging_bytes > 0 && (staging = AcquireStaging(staging_bytes)) == nullptr) {
+            break;
+        }
+        staged.clear();
+        bool torn = false;
+        auto* target = staging != nullptr ? staging->data.get() : nullptr;
+        for (auto i: members) {
+            const auto& upload = pending_[i];
+            if (!upload.NeedsStaging()) {
+                staged.push_back(nullptr);
+                continue;
+            }
+            if (!Stage(upload, target)) {
+                torn = true;
+                break;
+            }
+            staged.push_back(target);
+            target += upload.RegionBytes();
+        }
+        if (torn) {
+            for (auto i: members) {
+                outcomes[i] = Outcome::Torn;
+            }
+            stats_.torn += members.size();
+            continue;
+        }
+
+        for (size_t member = 0; member < members.size(); ++member) {
+            const auto& upload = pending_[members[member]];
+            Submit(upload, staging, staged[member]);
+            outcomes[members[member]] = Outcome::Submitted;
+
+            ++stats_.uploads;
+            stats_.bytes += upload.RegionBytes();
+        }
+        stats_.staged_bytes += staging_bytes;
+    }
+
+    // Deferred uploads keep their places, torn ones go last
+    nncc::vector<Upload> waiting, torn;
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        if (outcomes[i] == Outcome::Waiting) {
+            waiting.push_back(std::move(pending_[i]));
+        } else if (outcomes[i] == Outcome::Torn) {
+            torn.push_back(std::move(pending_[i]));
+        }
+    }
+    stats_.deferred = waiting.size();
+    pending_ = std::move(waiting);
+    for (auto& upload: torn) {
+        pending_.push_back(std::move(upload));
+    }
+    pending_by_texture_.clear();
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        pending_by_texture_[pending_[i].texture.idx] = i;
+    }
+}
+
+bool TextureUploader::Stage(const Upload& upload, uint8_t* target) {
+    // Seqlock read: the producer makes the sequence odd while it writes, and bumps it again when done
+    const auto sequence = upload.sequence ? upload.sequence->load(std::memory_order_acquire) : 0;
+    if (sequence % 2 != 0) {
+        return false;
+    }
+
+    const auto pitch = upload.Pitch(), pixel_bytes = pitch / upload.width;
+    const auto* source = static_cast<const uint8_t*>(upload.data);
+    for (const auto& region: upload.regions) {
+        const auto row_bytes = region.width * pixel_bytes;
+        for (uint16_t row = 0; row < region.height; ++row) {
+            std::memcpy(target, source + (region.y + row) * pitch + region.x * pixel_bytes, row_bytes);
+            target += row_bytes;
+        }
+    }
+
+    if (upload.sequence) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return upload.sequence->load(std::memory_order_relaxed) == sequence;
+    }
+    return true;
+}
+
+void TextureUploader::Submit(const Upload& upload, StagingBuffer* staging, const uint8_t* staged) {
+    const auto pitch = upload.Pitch(), pixel_bytes = pitch / upload.width;
+
+    if (staged == nullptr) {
+        const auto* source = static_cast<const uint8_t*>(upload.data);
+        for (const auto& region: upload.regions) {
+            const auto offset = region.y * pitch + region.x * pixel_bytes;
+            const auto size = (region.height - 1) * pitch + region.width * pixel_bytes;
+            auto memory = bgfx::makeRef(source + offset, static_cast<uint32_t>(size), &ReleaseOwner,
+                                        new std::shared_ptr<void>(upload.owner));
+            bgfx::updateTexture2D(upload.texture, 0, 0, region.x, region.y, region.width, region.height, memory,
+                                  static_cast<uint16_t>(pitch));
+        }
+        return;
+    }
+
+    // bgfx takes the row pitch of a region as uint16_t, so staged regions are packed one after the other
+    staging->references.fetch_add(static_cast<uint32_t>(upload.regions.size()), std::memory_order_relaxed);
+    for (const auto& region: upload.regions) {
+        const auto region_bytes = region.width * pixel_bytes * region.height;
+        auto memory = bgfx::makeRef(staged, static_cast<uint32_t>(region_bytes), &ReleaseStaging, staging);
+        bgfx::updateTexture2D(upload.texture, 0, 0, region.x, region.y, region.width, region.height, memory);
+        staged += region_bytes;
+    }
+}
+
+TextureUploader::StagingBuffer* TextureUploader::AcquireStaging(size_t bytes) {
+    // Only the render thread changes references of a buffer in use, and only downwards, so a free buffer stays free
+    const auto is_free = [](const StagingBuffer* buffer) {
+        return buffer->references.load(std::memory_order_acquire) == 1;
+    };
+
+    StagingBuffer* best = nullptr;
+    bool any_in_use = false;
+    for (auto* buffer: staging_) {
+        const bool free = is_free(buffer);
+        any_in_use = any_in_use || !free;
+        if (free && buffer->capacity >= bytes && (best == nullptr || buffer->capacity < best->capacity)) {
+            best = buffer;
+        }
+    }
+    if (best != nullptr) {
+        return best;
+    }
+
+    // Make room by dropping free buffers that are too small
+    if (staging_bytes_ + bytes > max_staging_) {
+        auto unused = std::remove_if(staging_.begin(), staging_.end(), [this, &is_free](StagingBuffer* buffer) {
+            if (!is_free(buffer)) {
+                return false;
+            }
+            staging_bytes_ -= buffer->capacity;
+            delete buffer;
+            return true;
+        });
+        staging_.erase(unused, staging_.end());
+    }
+
+    // Wait for the render thread to hand buffers back, unless nothing could ever be handed back
+    if (staging_bytes_ + bytes > max_staging_ && any_in_use) {
+        return nullptr;
+    }
+
+    best = new StagingBuffer(bytes);
+    staging_.push_back(best);
+    staging_bytes_ += bytes;
+    return best;
+}
+
+}
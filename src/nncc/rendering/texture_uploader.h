@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+#include <bgfx/bgfx.h>
+
+#include <nncc/common/types.h>
+
+namespace nncc::rendering {
+
+// Pixel rectangle of a texture
+struct TextureRegion {
+    uint16_t x = 0, y = 0, width = 0, height = 0;
+};
+
+// Compares an image with its previous version in blocks of `block` x `block` pixels, brings `previous` up to date and
+// returns the changed blocks merged into rectangles, at most `max_regions` of them or else their bounding box. Both
+// images are `height` rows of `width` pixels of `pixel_bytes` each.
+nncc::vector<TextureRegion> DiffTextureRegions(const uint8_t* image, uint8_t* previous, uint16_t width,
+                                               uint16_t height, size_t pixel_bytes, uint16_t block = 64,
+                                               size_t max_regions = 16);
+
+// Batches texture updates and submits them once per frame. Requests for a texture that is already waiting are
+// coalesced into the latest one, with the union of their regions, and at most `frame_budget` bytes are submitted per
+// frame (always at least one upload or group), so that the rest waits for the next frame instead of stalling this one.
+//
+// Memory the producer may overwrite at any time, such as a tensor shared with Python, is copied into one of a set of
+// persistent staging buffers at submission, which bgfx hands back once the render thread has read it. Otherwise bgfx
+// reads the memory directly, and `owner` keeps it alive until then. A producer that writes memory under a seqlock can
+// hand over its sequence word: a copy that overlapped a write is dropped and taken again in the next frame.
+//
+// Requests with the same nonzero `group`, such as the tensors of one training step, are submitted in the same frame or
+// not at all: the budget, a lack of staging memory or a torn copy of any of them defers the whole group. A later
+// request for a texture of a group moves it into the later group.
+//
+// Request, Cancel and Flush are called on the main thread.
+class TextureUploader {
+public:
+    struct Stats {
+        size_t uploads = 0;
+        size_t bytes = 0;
+        size_t staged_bytes = 0;
+        size_t coalesced = 0;
+        size_t deferred = 0;
+        size_t torn = 0;
+    };
+
+    explicit TextureUploader(size_t frame_budget = size_t(64) << 20, size_t max_staging = size_t(256) << 20);
+
+    ~TextureUploader();
+
+    TextureUploader(const TextureUploader&) = delete;
+
+    void operator=(const TextureUploader&) = delete;
+
+    // `data` holds all `height` rows of the texture. Only `regions` of it are uploaded, or all of it if they are
+    // empty.
+    void Request(bgfx::TextureHandle texture, uint16_t width, uint16_t height, const void* data, size_t bytes,
+                 std::shared_ptr<void> owner, bool producer_may_mutate, nncc::vector<TextureRegion> regions = {},
+                 const std::atomic<uint32_t>* sequence = nullptr, uint64_t group = 0);
+
+    // Drops a waiting request, must be called before destroying its texture
+    void Cancel(bgfx::TextureHandle texture);
+
+    // Submits waiting requests within the budget, to be called once per frame before bgfx::frame
+    void Flush();
+
+    void SetFrameBudget(size_t bytes) {
+        frame_budget_ = bytes;
+    }
+
+    // Of the last Flush
+    [[nodiscard]] const Stats& GetStats() const {
+        return stats_;
+    }
+
+private:
+    struct Upload {
+        bgfx::TextureHandle texture;
+        uint16_t width, height;
+        const void* data;
+        size_t bytes;
+        std::shared_ptr<void> owner;
+        bool producer_may_mutate;
+        nncc::vector<TextureRegion> regions;
+        const std::atomic<uint32_t>* sequence;
+        uint64_t group;
+
+        [[nodiscard]] size_t Pitch() const {
+            return bytes / height;
+        }
+
+        [[nodiscard]] size_t RegionBytes() const;
+
+        // Whether it is copied into staging memory rather than read by bgfx directly
+        [[nodiscard]] bool NeedsStaging() const {
+            return producer_may_mutate || Pitch() >= UINT16_MAX;
+        }
+    };
+
+    // More regions of one texture are merged into their bounding box
+    static constexpr size_t kMaxRegions = 16;
+
+    struct StagingBuffer;
+
+    // Called by bgfx, possibly on the render thread, once it has consumed the memory
+    static void ReleaseStaging(void* data, void* user_data);
+
+    StagingBuffer* AcquireStaging(size_t bytes);
+
+    // Copies the regions of an upload to `target` under its seqlock, returns false if the copy overlapped a write
+    static bool Stage(const Upload& upload, uint8_t* target);
+
+    // `staged` is where Stage copied the upload to, or null if bgfx reads it directly
+    static void Submit(const Upload& upload, StagingBuffer* staging, const uint8_t* staged);
+
+    size_t frame_budget_, max_staging_;
+    size_t staging_bytes_ = 0;
+
+    nncc::vector<Upload> pending_;
+    std::unordered_map<uint16_t, size_t> pending_by_texture_;
+
+    nncc::vector<StagingBuffer*> staging_;
+
+    Stats stats_;
+    size_t coalesced_ = 0;
+};
+
+}
@@ -15,10 +15,16 @@ auto PythonCodeOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
     return Result{0, ""};
 }
 
+uint64_t PythonCodeOpHashFn(const ComputeNode* node) {
+    return std::hash<nncc::string>{}(std::static_pointer_cast<PythonCodeOpState>(node->state)->code);
+}
+
 auto PythonCodeOpRenderFn(ComputeNode* node) {
     auto& state = *node->StateAs<PythonCodeOpState>();
 
     ImGui::InputTextMultiline("##pythoncode", &state.code);
+    // Only the user knows whether the code has side effects, so caching its results is opt-in
+    ImGui::Checkbox("Pure", &node->pure);
     if (ImGui::Button("Update")) {
         py::exec(state.code.c_str());
         return true;
@@ -32,11 +38,13 @@ ComputeNode MakePythonCodeOp(const void* _) {
 
     node.name = "Python code";
     node.type = "PythonCode";
+    node.affinity = ThreadAffinity::Main;
 
     node.AddOutput(Attribute("value", AttributeType::UserDefined));
 
     node.evaluate.connect<&PythonCodeOpEvaluateFn>();
     node.render_context_ui.connect<&PythonCodeOpRenderFn>();
+    node.hash_state.connect<&PythonCodeOpHashFn>();
 
     node.state = std::make_shared<PythonCodeOpState>();
 
@@ -56,7 +64,13 @@ auto GetSharedTensorOpEvaluateFn(ComputeNode* node, entt::registry* registry) {
     auto tensor_entity = tensor_registry->Get(state.name);
     state.entity = tensor_entity;
 
-    node->outputs_by_name.at("tensor").entity = state.entity;
+    auto& output = node->outputs[0];
+    output.entity = state.entity;
+    if (state.entity == entt::null) {
+        output.value = TensorView{};
+        return Result{1, fmt::format("No shared tensor named {}", state.name)};
+    }
+    output.value = registry->get<nncc::python::TensorWithPointer>(state.entity).View();
     return Result{0, ""};
 }
 
@@ -80,8 +94,9 @@ ComputeNode MakeGetSharedTensorOp(const void* _) {
 
     node.name = "Get Shared Tensor";
     node.type = "GetSharedTensor";
+    node.affinity = ThreadAffinity::Main;
 
-    node.AddOutput(Attribute("tensor", AttributeType::UserDefined));
+    node.AddOutput(Attribute("tensor", AttributeType::Tensor));
 
     node.evaluate.connect<&GetSharedTensorOpEvaluateFn>();
     node.render_context_ui.connect<&GetSharedTensorOpRenderFn>();
@@ -1,4 +1,5 @@
 #include <pybind11/embed.h>
+#include <pybind11/stl.h>
 
 #include <pynncc/torch/tensor_registry.h>
 #include <pynncc/torch/shm_communication.h>
@@ -8,6 +9,44 @@
 using namespace nncc;
 namespace py = pybind11;
 
+namespace {
+
+using Region = std::array<uint16_t, 4>;
+// Snapshot and storage written, of a snapshot update
+using SnapshotBuffer = std::optional<std::pair<uint8_t, uint8_t>>;
+using Update = std::tuple<std::string, std::string, std::string, uint8_t, std::vector<int64_t>, std::vector<Region>,
+                          SnapshotBuffer>;
+
+python::SharedTensorDescriptor MakeDescriptor(const Update& update) {
+    const auto& [name, manager_handle, filename, dtype, dims, regions, snapshot] = update;
+
+    python::SharedTensorDescriptor descriptor;
+    if (dims.size() > python::kSharedTensorMaxDims || regions.size() > python::kSharedTensorMaxRegions ||
+        name.size() > sizeof(descriptor.name) || manager_handle.size() > sizeof(descriptor.manager_handle) ||
+        filename.size() > sizeof(descriptor.filename) ||
+        (snapshot && snapshot->second >= python::kSharedTensorMaxBuffers)) {
+        throw std::invalid_argument("Tensor descriptor does not fit into a ring slot.");
+    }
+    if (snapshot) {
+        descriptor.kind = static_cast<uint8_t>(python::SharedTensorUpdateKind::Snapshot);
+        descriptor.snapshot = snapshot->first;
+        descriptor.buffer = snapshot->second;
+    }
+    descriptor.dtype = dtype;
+    descriptor.ndim = static_cast<uint8_t>(dims.size());
+    std::copy(dims.begin(), dims.end(), descriptor.dims);
+    descriptor.region_count = static_cast<uint8_t>(regions.size());
+    for (size_t i = 0; i < regions.size(); ++i) {
+        descriptor.regions[i] = {regions[i][0], regions[i][1], regions[i][2], regions[i][3]};
+    }
+    name.copy(descriptor.name, sizeof(descriptor.name));
+    manager_handle.copy(descriptor.manager_handle, sizeof(descriptor.manager_handle));
+    filename.copy(descriptor.filename, sizeof(descriptor.filename));
+    return descriptor;
+}
+
+}
+
 void SayHi() {
     auto& context = *context::Context::Get();
     py::print("Hello, world!");
@@ -15,4 +54,64 @@ void SayHi() {
 
 PYBIND11_MODULE(pynnccp, m) {
     m.def("say_hi", &SayHi);
+
+    // Producer side of the tensor update ring, with proper memory fences for pynncc.SharedTensorRing
+    py::class_<python::SharedTensorRing>(m, "SharedTensorRing")
+            .def_static("open", [](const std::string& name) {
+                return python::SharedTensorRing::Open(name);
+            })
+            .def("push", [](python::SharedTensorRing& ring, const std::string& name, const std::string& manager_handle,
+                            const std::string& filename, uint8_t dtype, const std::vector<int64_t>& dims,
+                            const std::vector<Region>& regions, const SnapshotBuffer& snapshot) {
+                return ring.TryPush(MakeDescriptor({name, manager_handle, filename, dtype, dims, regions, snapshot}));
+            }, py::arg("name"), py::arg("manager_handle"), py::arg("filename"), py::arg("dtype"), py::arg("dims"),
+               py::arg("regions") = std::vector<Region>{}, py::arg("snapshot") = SnapshotBuffer{})
+            // Updates as (name, manager_handle, filename, dtype, dims, regions, snapshot), published all at once
+            .def("push_batch", [](python::SharedTensorRing& ring, const std::vector<Update>& updates) {
+                if (updates.size() > ring.Capacity() || updates.size() > UINT16_MAX) {
+                    throw std::invalid_argument("Batch of tensor updates does not fit into the ring.");
+                }
+                std::vector<python::SharedTensorDescriptor> descriptors;
+                descriptors.reserve(updates.size());
+                for (const auto& update: updates) {
+                    descriptors.push_back(MakeDescriptor(update));
+                }
+                if (!descriptors.empty()) {
+                    descriptors[0].batch_size = static_cast<uint16_t>(descriptors.size());
+                }
+                return ring.TryPush(descriptors.data(), descriptors.size());
+            })
+            // A snapshot storage is written between these two, then the update naming it is pushed
+            .def("begin_write", &python::SharedTensorRing::BeginSnapshotWrite, py::arg("snapshot"), py::arg("buffer"))
+            .def("end_write", &python::SharedTensorRing::EndSnapshotWrite, py::arg("snapshot"), py::arg("buffer"),
+                 py::arg("generation"))
+            .def("generation", [](const python::SharedTensorRing& ring, uint8_t snapshot) {
+                return ring.Snapshot(snapshot).generation.load(std::memory_order_acquire);
+            }, py::arg("snapshot"))
+            .def_property_readonly("stopped", &python::SharedTensorRing::IsStopped)
+            .def_property_readonly_static("snapshot_count", [](py::object) {
+                return python::kSharedTensorSnapshots;
+            })
+            .def_property_readonly_static("max_buffers", [](py::object) {
+                return python::kSharedTensorMaxBuffers;
+            });
+
+    // Listener side of the control callback mailbox, see pynncc.SharedControlMailbox
+    py::class_<python::SharedControlMailbox>(m, "SharedControlMailbox")
+            .def_static("open", [](const std::string& name) {
+                return python::SharedControlMailbox::Open(name);
+            })
+            .def("wait", [](python::SharedControlMailbox& mailbox, double timeout) {
+                nncc::vector<nncc::string> requested;
+                {
+                    py::gil_scoped_release release;
+                    requested = mailbox.Wait(std::chrono::microseconds(static_cast<int64_t>(timeout * 1e6)));
+                }
+                std::vector<std::string> names;
+                for (const auto& name: requested) {
+                    names.push_back(name.toStdString());
+                }
+                return names;
+            }, py::arg("timeout"))
+            .def_property_readonly("stopped", &python::SharedControlMailbox::IsStopped);
 }
\ No newline at end of file
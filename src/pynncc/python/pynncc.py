@@ -1,8 +1,333 @@
+import contextlib
+import ctypes
+import platform
+import struct
+import sys
 import threading
+import time
+from multiprocessing import shared_memory
 
-import redis
 import torch
 
+try:
+    import pynnccp
+except ImportError:
+    pynnccp = None
+
+
+# compute::DType codes used in ring descriptors
+RING_DTYPES = {
+    torch.uint8: 0,
+    torch.int32: 1,
+    torch.float16: 2,
+    torch.bfloat16: 3,
+    torch.float32: 4,
+}
+
+_FUTEX_WAIT, _FUTEX_WAKE = 0, 1
+_FUTEX_SYSCALLS = {"x86_64": 202, "aarch64": 98}
+
+
+def _attach_shared_memory(name: str) -> shared_memory.SharedMemory:
+    # The segment belongs to the app, the resource tracker must not unlink it when this process exits
+    if sys.version_info >= (3, 13):
+        return shared_memory.SharedMemory(name=name, track=False)
+
+    segment = shared_memory.SharedMemory(name=name)
+    from multiprocessing import resource_tracker
+    resource_tracker.unregister(segment._name, "shared_memory")
+    return segment
+
+
+def _fit_regions(regions, max_regions: int):
+    """Clamps (x, y, width, height) rectangles to 16 bits, replacing too many of them with their bounding box."""
+    regions = [tuple(max(0, min(int(value), 0xFFFF)) for value in region) for region in regions]
+    if len(regions) <= max_regions:
+        return regions
+
+    left, top = min(x for x, _, _, _ in regions), min(y for _, y, _, _ in regions)
+    right, bottom = max(x + w for x, _, w, _ in regions), max(y + h for _, y, _, h in regions)
+    return [(left, top, min(right - left, 0xFFFF), min(bottom - top, 0xFFFF))]
+
+
+class _Snapshot(ctypes.Structure):
+    # SharedTensorSnapshot in shm_ring.h
+    _fields_ = [
+        ("generation", ctypes.c_uint64),
+        ("current", ctypes.c_uint32),
+        ("sequence", ctypes.c_uint32 * 4),
+        ("reserved", ctypes.c_uint8 * 36),
+    ]
+
+
+class SharedTensorRing:
+    """Producer side of the single-producer, single-consumer ring read by the app, see shm_ring.h for the layout.
+
+    Uses the compiled pynnccp module when it is available. The pure Python fallback publishes a descriptor with plain
+    stores, which relies on x86-64 keeping stores in order, so it refuses to run anywhere else. It may also miss a
+    consumer that is just going to sleep, in which case the app picks the update up within 2 ms.
+    """
+
+    HEADER = struct.Struct("<IIIII")
+    DESCRIPTOR = struct.Struct("<BBBBHBB8q64s64s56s32H")
+    MAGIC, VERSION = 0x52434E4E, 3
+    MAX_REGIONS, MAX_BUFFERS, SNAPSHOTS = 8, 4, 256
+    PLAIN, SNAPSHOT = 0, 1
+    HEAD, TAIL, SEQUENCE, CONSUMER_WAITING, STOPPED, SLOTS = 64, 128, 192, 196, 200, 256
+
+    def __init__(self, name: str = "nncc_tensors", timeout: float = 1.0):
+        self.timeout = timeout
+        self.native = None
+        if pynnccp is not None:
+            self.native = pynnccp.SharedTensorRing.open(f"/{name}")
+            if self.native is None:
+                raise FileNotFoundError(
+                    f"Could not open the tensor ring `{name}`: the app is not running or its ring is of another "
+                    f"version."
+                )
+            return
+
+        if platform.machine() not in ("x86_64", "AMD64"):
+            raise RuntimeError("Writing the tensor ring without pynnccp is only supported on x86-64.")
+
+        self.segment = _attach_shared_memory(name)
+        magic, version, self.capacity, slot_size, snapshot_count = self.HEADER.unpack_from(self.segment.buf, 0)
+        if (
+                magic != self.MAGIC or version != self.VERSION or slot_size != self.DESCRIPTOR.size
+                or snapshot_count != self.SNAPSHOTS
+        ):
+            raise RuntimeError(f"Shared memory segment `{name}` is not a tensor ring of a compatible version.")
+
+        buffer = self.segment.buf
+        self.head = ctypes.c_uint64.from_buffer(buffer, self.HEAD)
+        self.tail = ctypes.c_uint64.from_buffer(buffer, self.TAIL)
+        self.sequence = ctypes.c_uint32.from_buffer(buffer, self.SEQUENCE)
+        self.consumer_waiting = ctypes.c_uint32.from_buffer(buffer, self.CONSUMER_WAITING)
+        self.stopped_flag = ctypes.c_uint32.from_buffer(buffer, self.STOPPED)
+        snapshots_offset = self.SLOTS + self.capacity * self.DESCRIPTOR.size
+        self.snapshots = (_Snapshot * self.SNAPSHOTS).from_buffer(buffer, snapshots_offset)
+
+        self.futex = _FUTEX_SYSCALLS.get(platform.machine()) if sys.platform.startswith("linux") else None
+        self.libc = ctypes.CDLL(None, use_errno=True) if self.futex is not None else None
+
+    def push(self, name: str, manager_handle: bytes, filename: bytes, dtype: int, shape, regions=None, snapshot=None):
+        """Publishes an update of a tensor. For an image, `regions` may list the (x, y, width, height) rectangles that
+        changed, otherwise the app compares the image with the previous one itself. A `snapshot` update names the
+        (snapshot, buffer) it has just written, see begin_write."""
+        self.push_batch([(name, manager_handle, filename, dtype, shape, regions, snapshot)])
+
+    def push_batch(self, updates):
+        """Publishes (name, manager_handle, filename, dtype, shape, regions, snapshot) updates at once: the app sees
+        either none or all of them, and applies them within the same frame."""
+        updates = [
+            (name, manager_handle, filename, dtype, list(shape), _fit_regions(regions or [], self.MAX_REGIONS),
+             snapshot)
+            for name, manager_handle, filename, dtype, shape, regions, snapshot in updates
+        ]
+        if not updates:
+            return
+
+        deadline = time.monotonic() + self.timeout
+        if self.native is not None:
+            if len(updates) == 1:
+                name, manager_handle, filename, dtype, shape, regions, snapshot = updates[0]
+                while not self.native.push(name, manager_handle.decode(), filename.decode(), dtype, shape, regions,
+                                           snapshot):
+                    if self.native.stopped:
+                        raise RuntimeError("The app has stopped reading tensor updates.")
+                    self._wait_for_space(deadline)
+                return
+
+            native_updates = [
+                (name, manager_handle.decode(), filename.decode(), dtype, shape, regions, snapshot)
+                for name, manager_handle, filename, dtype, shape, regions, snapshot in updates
+            ]
+            while not self.native.push_batch(native_updates):
+                if self.native.stopped:
+                    raise RuntimeError("The app has stopped reading tensor updates.")
+                self._wait_for_space(deadline)
+            return
+
+        if len(updates) > min(self.capacity, 0xFFFF):
+            raise ValueError("Batch of tensor updates does not fit into the ring.")
+        for name, manager_handle, filename, _, shape, _, snapshot in updates:
+            if len(shape) > 8 or len(name.encode()) > 64 or len(manager_handle) > 64 or len(filename) > 56:
+                raise ValueError("Tensor descriptor does not fit into a ring slot.")
+            if snapshot is not None and snapshot[1] >= self.MAX_BUFFERS:
+                raise ValueError("Tensor descriptor does not fit into a ring slot.")
+
+        head = self.head.value
+        while head + len(updates) - self.tail.value > self.capacity:
+            if self.stopped_flag.value:
+                raise RuntimeError("The app has stopped reading tensor updates.")
+            self._wait_for_space(deadline)
+
+        for index, (name, manager_handle, filename, dtype, shape, regions, snapshot) in enumerate(updates):
+            dims = shape + [0] * (8 - len(shape))
+            packed_regions = [value for region in regions for value in region]
+            packed_regions += [0] * (4 * self.MAX_REGIONS - len(packed_regions))
+            batch_size = len(updates) if index == 0 and len(updates) > 1 else 0
+            kind, (slot, buffer) = (self.PLAIN, (0, 0)) if snapshot is None else (self.SNAPSHOT, snapshot)
+            offset = self.SLOTS + ((head + index) % self.capacity) * self.DESCRIPTOR.size
+            self.DESCRIPTOR.pack_into(self.segment.buf, offset, kind, dtype, len(shape), len(regions), batch_size,
+                                      slot, buffer, *dims, name.encode(), manager_handle, filename, *packed_regions)
+        self.head.value = head + len(updates)
+
+        if self.consumer_waiting.value:
+            self.sequence.value += 1
+            if self.futex is not None:
+                self.libc.syscall(self.futex, ctypes.c_void_p(ctypes.addressof(self.sequence)), _FUTEX_WAKE, 1,
+                                  None, None, 0)
+
+    @property
+    def stopped(self) -> bool:
+        """Whether the app has stopped reading updates, after which the shared storages may go."""
+        if self.native is not None:
+            return self.native.stopped
+        return bool(self.stopped_flag.value)
+
+    def generation(self, snapshot: int) -> int:
+        """Generation of the last completed write of a snapshot."""
+        if self.native is not None:
+            return self.native.generation(snapshot)
+        return self.snapshots[snapshot].generation
+
+    def begin_write(self, snapshot: int, buffer: int):
+        """Marks a storage of a snapshot as being written, so that the app does not take a half-written tensor."""
+        if self.native is not None:
+            self.native.begin_write(snapshot, buffer)
+            return
+        self.snapshots[snapshot].sequence[buffer] += 1
+
+    def end_write(self, snapshot: int, buffer: int, generation: int):
+        """Marks a storage as written and the latest version of its tensor, before the update naming it is pushed."""
+        if self.native is not None:
+            self.native.end_write(snapshot, buffer, generation)
+            return
+        state = self.snapshots[snapshot]
+        state.sequence[buffer] += 1
+        state.current = buffer
+        state.generation = generation
+
+    def _wait_for_space(self, deadline: float):
+        if time.monotonic() > deadline:
+            raise TimeoutError("The app does not read tensor updates.")
+        time.sleep(50e-6)
+
+    def close(self):
+        if self.native is not None:
+            self.native = None
+            return
+
+        # Views into the segment have to go before it can be closed
+        del self.head, self.tail, self.sequence, self.consumer_waiting, self.stopped_flag, self.snapshots
+        self.segment.close()
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+
+class SharedControlMailbox:
+    """Listener side of the mailbox through which the app asks for control callbacks, see shm_control.h for the
+    layout. Requests for a callback that arrive while it runs are coalesced into a single further call.
+
+    Uses the compiled pynnccp module when it is available. The pure Python fallback sleeps on the futex on Linux and
+    polls elsewhere.
+    """
+
+    HEADER = struct.Struct("<IIII")
+    SLOT = struct.Struct("<64sI60x")
+    MAGIC, VERSION = 0x434E4E4E, 1
+    SLOTS_COUNT = 64
+    USED, SEQUENCE, LISTENER_WAITING, STOPPED, SLOTS = 64, 128, 132, 136, 256
+    MAX_SLEEP = 0.1
+
+    def __init__(self, name: str = "nncc_controls"):
+        self.native = pynnccp.SharedControlMailbox.open(f"/{name}") if pynnccp is not None else None
+        if self.native is not None:
+            return
+
+        self.segment = _attach_shared_memory(name)
+        magic, version, slot_count, slot_size = self.HEADER.unpack_from(self.segment.buf, 0)
+        if (
+                magic != self.MAGIC or version != self.VERSION or slot_count != self.SLOTS_COUNT
+                or slot_size != self.SLOT.size
+        ):
+            raise RuntimeError(f"Shared memory segment `{name}` is not a control mailbox of a compatible version.")
+
+        buffer = self.segment.buf
+        self.used = ctypes.c_uint32.from_buffer(buffer, self.USED)
+        self.sequence = ctypes.c_uint32.from_buffer(buffer, self.SEQUENCE)
+        self.listener_waiting = ctypes.c_uint32.from_buffer(buffer, self.LISTENER_WAITING)
+        self.stopped_flag = ctypes.c_uint32.from_buffer(buffer, self.STOPPED)
+        self.handled = [0] * self.SLOTS_COUNT
+
+        self.futex = _FUTEX_SYSCALLS.get(platform.machine()) if sys.platform.startswith("linux") else None
+        self.libc = ctypes.CDLL(None, use_errno=True) if self.futex is not None else None
+
+    @property
+    def stopped(self) -> bool:
+        if self.native is not None:
+            return self.native.stopped
+        return bool(self.stopped_flag.value)
+
+    def wait(self, timeout: float):
+        """Returns the names of the callbacks requested since the last call, waiting up to `timeout` seconds for one.
+        Returns an empty list once the app is gone."""
+        if self.native is not None:
+            return self.native.wait(timeout)
+
+        deadline = time.monotonic() + timeout
+        while not self.stopped:
+            sequence = self.sequence.value
+            requested = self._take_requests()
+            if requested:
+                return requested
+
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                break
+            remaining = min(remaining, self.MAX_SLEEP)
+            # The app moves the sequence on every request, so the futex returns at once if one came in meanwhile
+            self.listener_waiting.value = 1
+            if self.futex is not None:
+                duration = _Timespec(int(remaining), int((remaining % 1) * 1e9))
+                self.libc.syscall(self.futex, ctypes.c_void_p(ctypes.addressof(self.sequence)), _FUTEX_WAIT,
+                                  sequence, ctypes.byref(duration), None, 0)
+            elif self.sequence.value == sequence:
+                time.sleep(min(remaining, 1e-3))
+            self.listener_waiting.value = 0
+        return []
+
+    def _take_requests(self):
+        requested = []
+        for index in range(min(self.used.value, self.SLOTS_COUNT)):
+            name, requests = self.SLOT.unpack_from(self.segment.buf, self.SLOTS + index * self.SLOT.size)
+            if requests != self.handled[index]:
+                self.handled[index] = requests
+                requested.append(name.rstrip(b"\0").decode())
+        return requested
+
+    def close(self):
+        if self.native is not None:
+            self.native = None
+            return
+
+        del self.used, self.sequence, self.listener_waiting, self.stopped_flag
+        self.segment.close()
+
+
+def get_tensor_shm_descriptor(tensor: torch.Tensor):
+    """Returns the manager handle, file name, ring dtype code and shape of a tensor in shared memory."""
+    if not tensor.is_shared():
+        raise ValueError("Supplied tensor is not in shared memory.")
+    if tensor.dtype not in RING_DTYPES:
+        raise ValueError(f"Unsupported dtype {tensor.dtype}.")
+
+    manager_handle, filename, _ = tensor.storage()._share_filename_cpu_()
+    return manager_handle, filename, RING_DTYPES[tensor.dtype], tuple(tensor.shape)
+
 
 def get_tensor_shm_handle(name: str, tensor: torch.Tensor) -> str:
     if not tensor.is_shared():
@@ -24,12 +349,71 @@ def get_tensor_shm_handle(name: str, tensor: torch.Tensor) -> str:
 
 
 class NNCCStorage:
-    def __init__(self):
-        self.redis = redis.Redis(host='localhost', port=6379, db=0)
+    def __init__(self, transport: str = "ring", buffers: int = 3):
+        """Shares tensors with the app, over the shared memory ring or, with transport="redis", the legacy queue.
+
+        Over the ring, each tensor is written into `buffers` shared storages in turn, so that the app can still read
+        the previous version while the next one is written, and never takes a half-written one."""
+        self.ring = None
+        self.redis = None
+        if transport == "ring":
+            self.ring = SharedTensorRing()
+        elif transport == "redis":
+            import redis
+            self.redis = redis.Redis(host='localhost', port=6379, db=0)
+        else:
+            raise ValueError(f"Unknown transport `{transport}`.")
+
         self.storage = dict()
         self.handles = dict()
 
-    def submit_tensor(self, name: str, tensor: torch.Tensor, overwrite: bool = False):
+        # By name: storages written in turn with their handles, snapshot and generation of the last write
+        self.buffers = max(1, min(buffers, SharedTensorRing.MAX_BUFFERS))
+        self.snapshot_storage = dict()
+        self.snapshot_handles = dict()
+        self.snapshots = dict()
+        self.generations = dict()
+        self.free_snapshots = list(reversed(range(SharedTensorRing.SNAPSHOTS))) if self.ring is not None else []
+
+        # Updates waiting for the end of a batch
+        self.pending = None
+
+    @contextlib.contextmanager
+    def batch(self):
+        """Publishes all tensors submitted within the block as one update, which the app applies in a single frame:
+
+            with storage.batch():
+                storage.submit_tensor("image", image)
+                storage.submit_tensor("loss", loss)
+        """
+        if self.pending is not None:
+            yield self
+            return
+
+        self.pending = []
+        try:
+            yield self
+            if self.ring is not None:
+                self.ring.push_batch(self.pending)
+            elif self.pending:
+                self.redis.lpush("nncc_tensors", *self.pending)
+        finally:
+            self.pending = None
+
+    def submit_tensors(self, tensors: dict, overwrite: bool = False):
+        """Shares tensors by name as one update, see batch."""
+        with self.batch():
+            return {name: self.submit_tensor(name, tensor, overwrite=overwrite) for name, tensor in tensors.items()}
+
+    def submit_tensor(self, name: str, tensor: torch.Tensor, overwrite: bool = False, regions=None, control=None):
+        """Shares a tensor under a name. For an H x W x C image, `regions` may list the (x, y, width, height)
+        rectangles that changed since the last submission, so that the app only uploads those.
+
+        A control tensor, by default one of at most one dimension, is edited by the app's sliders. It is shared in a
+        single storage, the one `self.storage[name]` refers to, so that control callbacks read the edited values.
+        Other tensors are written into snapshot storages in turn, see __init__."""
+        if control is None:
+            control = tensor.ndim <= 1
         if (
                 name in self.storage
                 and not overwrite
@@ -46,27 +430,100 @@ class NNCCStorage:
                     f"to shared memory storage `{name}`: {self.storage[name].dtype}."
                 )
 
-        if name not in self.storage or overwrite:
+        # A tensor of the same shape and dtype is copied into the storage the app has mapped already, even when
+        # overwriting: a new storage would have a new file name, which the app would have to map again
+        same_layout = (
+                name in self.storage
+                and self.storage[name].shape == tensor.shape
+                and self.storage[name].dtype == tensor.dtype
+        )
+
+        if name not in self.storage or (overwrite and not same_layout):
             self.storage[name] = tensor
-            handle = get_tensor_shm_handle(name, self.storage[name].share_memory_())
-            self.handles[name] = handle
-        else:
-            self.storage[name].copy_(tensor)
+            if control:
+                self._release_snapshot(name)
+            if control or not self._allocate_snapshot(name, tensor):
+                shared = self.storage[name].share_memory_()
+                handle = (
+                    get_tensor_shm_descriptor(shared) if self.ring is not None else get_tensor_shm_handle(name, shared)
+                )
+                self.handles[name] = handle
+        elif name not in self.snapshots:
+            if self.storage[name] is not tensor:
+                self.storage[name].copy_(tensor)
             handle = self.handles[name]
 
-        self.redis.lpush("nncc_tensors", f"{name}::{handle}")
+        if name in self.snapshots:
+            snapshot = self.snapshots[name]
+            generation = self.generations[name] + 1
+            buffer = generation % len(self.snapshot_storage[name])
+
+            # The storages are private, so every write of them goes through the seqlock
+            self.ring.begin_write(snapshot, buffer)
+            self.snapshot_storage[name][buffer].copy_(tensor)
+            self.ring.end_write(snapshot, buffer, generation)
+
+            self.generations[name] = generation
+            handle = self.snapshot_handles[name][buffer]
+            update = (name, *handle, regions, (snapshot, buffer))
+        elif self.ring is not None:
+            update = (name, *handle, regions, None)
+        else:
+            update = f"{name}::{handle}"
+
+        if self.pending is not None:
+            self.pending.append(update)
+        elif self.ring is not None:
+            self.ring.push(*update)
+        else:
+            self.redis.lpush("nncc_tensors", update)
 
         return handle
 
+    def _allocate_snapshot(self, name: str, tensor: torch.Tensor) -> bool:
+        """Sets up the storages a tensor is written into in turn. Returns False if the snapshots of the ring ran out,
+        in which case the tensor is shared in a single storage of its own."""
+        if self.ring is None:
+            return False
+        if name not in self.snapshots:
+            if not self.free_snapshots:
+                return False
+            self.snapshots[name] = self.free_snapshots.pop()
+
+        # None of them is the caller's tensor, which the caller goes on writing without the seqlock
+        storages = [
+            torch.empty_like(tensor, memory_format=torch.contiguous_format).share_memory_()
+            for _ in range(self.buffers)
+        ]
+        self.snapshot_storage[name] = storages
+        self.snapshot_handles[name] = [get_tensor_shm_descriptor(storage) for storage in storages]
+        # Continues after a previous producer, so that the app does not mistake a new version for one it has seen
+        self.generations[name] = self.ring.generation(self.snapshots[name])
+        return True
+
+    def _release_snapshot(self, name: str):
+        if name in self.snapshots:
+            self.free_snapshots.append(self.snapshots.pop(name))
+            del self.snapshot_storage[name], self.snapshot_handles[name], self.generations[name]
+
+
+def nncc_request_listener(fn_handles, name: str = "nncc_controls"):
+    """Runs the callbacks in `fn_handles` by name as the app asks for them, until the app exits."""
+    mailbox = None
+    while mailbox is None:
+        try:
+            mailbox = SharedControlMailbox(name)
+        except FileNotFoundError:
+            time.sleep(0.1)
 
-def busywaiting_nncc_request_listener(fn_handles):
-    redis_client = redis.Redis(host="localhost", port=6379, db=0)
+    try:
+        while not mailbox.stopped:
+            for callback_name in mailbox.wait(timeout=1.0):
+                if callback_name in fn_handles:
+                    fn_handles[callback_name]()
+    finally:
+        mailbox.close()
 
-    while True:
-        _, value = redis_client.blpop(["nncc_requests"], timeout=0)
 
-        value = value.decode("utf-8")
-        if value == "::done::":
-            break
-        fn_handles[value]()
-        redis_client.set(f"nncc_{value}", "true")
+# Former name, from when requests went through Redis
+busywaiting_nncc_request_listener = nncc_request_listener
@@ -0,0 +1,64 @@
+import torch
+
+import pynncc
+
+
+class RecordingRing(pynncc.SharedTensorRing):
+    """Stands in for the app's ring, keeping the updates pushed to it."""
+
+    def __init__(self, name: str = "nncc_tensors", timeout: float = 1.0):
+        self.updates = []
+
+    def push(self, *update):
+        self.updates.append(update)
+
+    def push_batch(self, updates):
+        self.updates.extend(updates)
+
+    def generation(self, snapshot: int) -> int:
+        return 0
+
+    def begin_write(self, snapshot: int, buffer: int):
+        pass
+
+    def end_write(self, snapshot: int, buffer: int, generation: int):
+        pass
+
+
+def map_like_app(update) -> torch.Tensor:
+    """Maps the storage of a plain update the way TensorRegistry does, through the torch shared memory manager."""
+    name, manager_handle, filename, _, shape, regions, snapshot = update
+    assert snapshot is None, f"`{name}` was shared through a snapshot"
+
+    size = torch.Size(shape).numel() * torch.float32.itemsize
+    mapped = torch.UntypedStorage._new_shared_filename_cpu(manager_handle, filename, size)
+    return torch.empty(0, dtype=torch.float32).set_(mapped, 0, shape)
+
+
+def test_slider_round_trip():
+    pynncc.SharedTensorRing = RecordingRing
+    storage = pynncc.NNCCStorage()
+
+    controls = torch.zeros(4)
+    storage.submit_tensor("controls", controls)
+    assert "controls" not in storage.snapshots
+    slider = map_like_app(storage.ring.updates[-1])
+
+    # A slider edit is what the control callbacks read
+    slider[2] = 1.5
+    assert storage.storage["controls"][2].item() == 1.5
+    assert controls[2].item() == 1.5
+
+    # And the producer's next values are what the sliders show
+    storage.submit_tensor("controls", torch.full((4,), 0.25))
+    assert storage.ring.updates[-1][2] == storage.ring.updates[0][2]
+    assert torch.equal(slider, torch.full((4,), 0.25))
+
+    # Images still go through the snapshots
+    storage.submit_tensor("image", torch.zeros(8, 8, 3))
+    assert "image" in storage.snapshots
+
+
+if __name__ == "__main__":
+    test_slider_round_trip()
+    print("ok")
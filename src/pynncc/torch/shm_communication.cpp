@@ -1,11 +1,109 @@
 #include "tensor_registry.h"
 #include "shm_communication.h"
 
+#include <cstring>
+
 #include <folly/String.h>
 #include <folly/Range.h>
 
 namespace nncc::python {
 
+namespace {
+
+nncc::string FromField(const char* field, size_t size) {
+    return {field, strnlen(field, size)};
+}
+
+bool ToSharedTensorEvent(const std::shared_ptr<const SharedTensorRing>& ring,
+                         const SharedTensorDescriptor& descriptor, SharedTensorEvent* event) {
+    switch (static_cast<compute::DType>(descriptor.dtype)) {
+        case compute::DType::UInt8:
+            event->dtype = torch::kUInt8;
+            break;
+        case compute::DType::Int32:
+            event->dtype = torch::kInt32;
+            break;
+        case compute::DType::Float16:
+            event->dtype = torch::kFloat16;
+            break;
+        case compute::DType::BFloat16:
+            event->dtype = torch::kBFloat16;
+            break;
+        case compute::DType::Float32:
+            event->dtype = torch::kFloat32;
+            break;
+        default:
+            return false;
+    }
+    if (descriptor.ndim > kSharedTensorMaxDims || descriptor.region_count > kSharedTensorMaxRegions) {
+        return false;
+    }
+    if (descriptor.kind == static_cast<uint8_t>(SharedTensorUpdateKind::Snapshot)) {
+        if (descriptor.buffer >= kSharedTensorMaxBuffers) {
+            return false;
+        }
+        event->ring = ring;
+        event->snapshot = descriptor.snapshot;
+        event->buffer = descriptor.buffer;
+    }
+
+    event->name = FromField(descriptor.name, sizeof(descriptor.name));
+    event->manager_handle = FromField(descriptor.manager_handle, sizeof(descriptor.manager_handle));
+    event->filename = FromField(descriptor.filename, sizeof(descriptor.filename));
+    event->dims.assign(descriptor.dims, descriptor.dims + descriptor.ndim);
+    for (uint8_t i = 0; i < descriptor.region_count; ++i) {
+        const auto& region = descriptor.regions[i];
+        event->regions.push_back({region.x, region.y, region.width, region.height});
+    }
+    return true;
+}
+
+}
+
+int StartSharedTensorRingLoop(bx::Thread* self, void* dispatcher_) {
+    // Shared with the events, which refer to its snapshots until they are applied
+    std::shared_ptr<SharedTensorRing> ring = SharedTensorRing::Create(kSharedTensorRingName);
+    if (!ring) {
+        return 1;
+    }
+
+    auto dispatcher = static_cast<entt::dispatcher*>(dispatcher_);
+    SharedTensorDescriptor descriptor;
+    while (!ring->IsStopped()) {
+        if (!ring->Pop(&descriptor, std::chrono::milliseconds(100))) {
+            continue;
+        }
+
+        SharedTensorEvent event;
+        if (descriptor.batch_size <= 1) {
+            if (ToSharedTensorEvent(ring, descriptor, &event)) {
+                dispatcher->enqueue(event);
+            }
+            continue;
+        }
+
+        // The rest of a batch was published together with its first descriptor
+        SharedTensorBatchEvent batch;
+        batch.updates.reserve(descriptor.batch_size);
+        const auto batch_size = descriptor.batch_size;
+        for (uint16_t i = 0; i < batch_size; ++i) {
+            if ((i == 0 || ring->TryPop(&descriptor)) && ToSharedTensorEvent(ring, descriptor, &event)) {
+                batch.updates.push_back(std::move(event));
+                event = SharedTensorEvent{};
+            }
+        }
+        dispatcher->enqueue(std::move(batch));
+    }
+
+    return 0;
+}
+
+void StopSharedTensorRingLoop(const nncc::string& ring_name) {
+    if (auto ring = SharedTensorRing::Open(ring_name)) {
+        ring->Stop();
+    }
+}
+
 int StartSharedTensorRedisLoop(bx::Thread* self, void* dispatcher_) {
     cpp_redis::client redis;
     redis.connect();
@@ -14,7 +112,6 @@ int StartSharedTensorRedisLoop(bx::Thread* self, void* dispatcher_) {
     auto queue_name = kRedisQueueName;
 
     redis.del({queue_name.toStdString()});
-    redis.del({"nncc_requests"});
     redis.sync_commit();
     bool done = false;
 
@@ -4,11 +4,22 @@
 
 #include <nncc/common/types.h>
 #include <nncc/context/context.h>
+#include <pynncc/torch/shm_control.h>
+#include <pynncc/torch/shm_ring.h>
 
 namespace nncc::python {
 
 const nncc::string kRedisQueueName = "nncc_tensors";
 const nncc::string kRedisStopString = "::done::";
+const nncc::string kSharedTensorRingName = "/nncc_tensors";
+const nncc::string kSharedControlMailboxName = "/nncc_controls";
+
+// Receives tensor updates from the shared memory ring written by pynncc.py, no Redis server needed
+int StartSharedTensorRingLoop(bx::Thread* self, void* dispatcher_);
+
+void StopSharedTensorRingLoop(const nncc::string& ring_name);
+
+// Legacy transport: one Redis round trip per update
 
 int StartSharedTensorRedisLoop(bx::Thread* self, void* dispatcher_);
 
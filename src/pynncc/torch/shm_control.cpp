@@ -0,0 +1,187 @@
+#include "shm_control.h"
+#include "shm_ring.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nncc::python {
+
+namespace {
+
+constexpr uint32_t kMailboxMagic = 0x434e4e4e;  // "NNNC"
+constexpr uint32_t kMailboxVersion = 1;
+constexpr size_t kSlotsOffset = 256;
+constexpr size_t kSegmentSize = kSlotsOffset + kSharedControlSlots * sizeof(SharedControlSlot);
+
+// Upper bound for a single sleep, so that the listener notices a stop from a crashed app
+constexpr auto kMaxSleep = std::chrono::milliseconds(100);
+
+}
+
+// Offsets are part of the protocol, see pynncc.py
+struct SharedControlMailbox::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+
+    // Slots taken so far, each published with its name
+    alignas(64) std::atomic<uint32_t> used;
+
+    // Futex word, bumped by the app on every request
+    alignas(64) std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> listener_waiting;
+    std::atomic<uint32_t> stopped;
+};
+
+std::unique_ptr<SharedControlMailbox> SharedControlMailbox::Create(const nncc::string& name) {
+    static_assert(offsetof(Header, used) == 64 && offsetof(Header, sequence) == 128);
+    static_assert(offsetof(Header, listener_waiting) == 132 && offsetof(Header, stopped) == 136);
+    static_assert(sizeof(Header) <= kSlotsOffset);
+    static_assert(offsetof(SharedControlSlot, requests) == 64);
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(kSegmentSize)) == 0) {
+        memory = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    // The slots are zero as the segment is new
+    auto* header = new(memory) Header{kMailboxMagic, kMailboxVersion, kSharedControlSlots, sizeof(SharedControlSlot)};
+    header->used.store(0);
+    header->sequence.store(0);
+    header->listener_waiting.store(0);
+    header->stopped.store(0);
+
+    return std::unique_ptr<SharedControlMailbox>(new SharedControlMailbox(name, memory, kSegmentSize, true));
+}
+
+std::unique_ptr<SharedControlMailbox> SharedControlMailbox::Open(const nncc::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info{};
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= kSegmentSize) {
+        memory = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const auto* header = static_cast<const Header*>(memory);
+    if (header->magic != kMailboxMagic || header->version != kMailboxVersion ||
+        header->slot_count != kSharedControlSlots || header->slot_size != sizeof(SharedControlSlot)) {
+        munmap(memory, kSegmentSize);
+        return nullptr;
+    }
+
+    return std::unique_ptr<SharedControlMailbox>(new SharedControlMailbox(name, memory, kSegmentSize, false));
+}
+
+SharedControlMailbox::SharedControlMailbox(nncc::string name, void* memory, size_t size, bool owner)
+        : name_(std::move(name)), memory_(memory), size_(size), owner_(owner), header_(static_cast<Header*>(memory)),
+          handled_(kSharedControlSlots, 0) {}
+
+SharedControlMailbox::~SharedControlMailbox() {
+    if (owner_) {
+        Stop();
+    }
+    munmap(memory_, size_);
+    if (owner_) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+SharedControlSlot* SharedControlMailbox::Slot(uint32_t index) const {
+    return reinterpret_cast<SharedControlSlot*>(static_cast<uint8_t*>(memory_) + kSlotsOffset) + index;
+}
+
+bool SharedControlMailbox::Request(const nncc::string& callback_name) {
+    auto found = slots_.find(callback_name);
+    if (found == slots_.end()) {
+        const auto used = header_->used.load(std::memory_order_relaxed);
+        if (used == kSharedControlSlots || callback_name.size() > sizeof(SharedControlSlot::callback_name)) {
+            return false;
+        }
+        callback_name.copy(Slot(used)->callback_name, sizeof(SharedControlSlot::callback_name));
+        header_->used.store(used + 1, std::memory_order_release);
+        found = slots_.emplace(callback_name, used).first;
+    }
+
+    Slot(found->second)->requests.fetch_add(1, std::memory_order_release);
+
+    // Every request moves the futex word, so that a listener about to sleep on the old value returns right away. The
+    // syscall is only made when the listener sleeps.
+    header_->sequence.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->listener_waiting.load(std::memory_order_relaxed) != 0) {
+        WakeSharedWord(header_->sequence);
+    }
+    return true;
+}
+
+nncc::vector<nncc::string> SharedControlMailbox::TakeRequests() {
+    nncc::vector<nncc::string> requested;
+    const auto used = header_->used.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < used; ++i) {
+        auto* slot = Slot(i);
+        const auto requests = slot->requests.load(std::memory_order_acquire);
+        if (requests != handled_[i]) {
+            handled_[i] = requests;
+            requested.emplace_back(slot->callback_name, strnlen(slot->callback_name, sizeof(slot->callback_name)));
+        }
+    }
+    return requested;
+}
+
+nncc::vector<nncc::string> SharedControlMailbox::Wait(std::chrono::microseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!IsStopped()) {
+        const auto sequence = header_->sequence.load(std::memory_order_acquire);
+        auto requested = TakeRequests();
+        if (!requested.empty()) {
+            return requested;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        header_->listener_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        WaitOnSharedWord(header_->sequence, sequence, std::min<std::chrono::microseconds>(
+                std::chrono::duration_cast<std::chrono::microseconds>(deadline - now), kMaxSleep));
+        header_->listener_waiting.store(0, std::memory_order_relaxed);
+    }
+    return {};
+}
+
+void SharedControlMailbox::Stop() {
+    header_->stopped.store(1, std::memory_order_release);
+    WakeSharedWord(header_->sequence);
+}
+
+bool SharedControlMailbox::IsStopped() const {
+    return header_->stopped.load(std::memory_order_acquire) != 0;
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <nncc/common/types.h>
+
+namespace nncc::python {
+
+constexpr size_t kSharedControlSlots = 64;
+
+// Callback the app asks the producer to run, mirrored by SharedControlMailbox in pynncc.py. The name is written once
+// when the slot is taken; `requests` counts how often the callback was asked for.
+struct SharedControlSlot {
+    char callback_name[64]{};
+    std::atomic<uint32_t> requests;
+    uint8_t reserved[60]{};
+};
+
+static_assert(sizeof(SharedControlSlot) == 128);
+
+// Requests from the app to run the producer's control callbacks, e.g. after a slider moved, in a POSIX shared memory
+// segment. The app only bumps a counter per callback and never waits for the listener, which compares the counters
+// with the ones it has handled: any number of requests for a callback that arrive while the listener is busy are
+// coalesced into a single call, which reads the latest values of the shared tensors. The listener sleeps on the
+// sequence word, see WaitOnSharedWord.
+class SharedControlMailbox {
+public:
+    // App side: replaces any segment left over under this name, and removes it on destruction, which stops the listener
+    static std::unique_ptr<SharedControlMailbox> Create(const nncc::string& name);
+
+    // Listener side. Null if the app has not created the mailbox yet.
+    static std::unique_ptr<SharedControlMailbox> Open(const nncc::string& name);
+
+    ~SharedControlMailbox();
+
+    SharedControlMailbox(const SharedControlMailbox&) = delete;
+
+    void operator=(const SharedControlMailbox&) = delete;
+
+    // Never blocks. False if all slots are taken by other callbacks, or the name does not fit into one.
+    bool Request(const nncc::string& callback_name);
+
+    // Callbacks requested since the last call, waiting for one until the timeout passes or the mailbox is stopped
+    nncc::vector<nncc::string> Wait(std::chrono::microseconds timeout);
+
+    void Stop();
+
+    [[nodiscard]] bool IsStopped() const;
+
+private:
+    struct Header;
+
+    SharedControlMailbox(nncc::string name, void* memory, size_t size, bool owner);
+
+    [[nodiscard]] SharedControlSlot* Slot(uint32_t index) const;
+
+    nncc::vector<nncc::string> TakeRequests();
+
+    nncc::string name_;
+    void* memory_;
+    size_t size_;
+    bool owner_;
+    Header* header_;
+
+    // App side: slots by callback name. Listener side: requests handled per slot.
+    std::unordered_map<nncc::string, uint32_t> slots_;
+    nncc::vector<uint32_t> handled_;
+};
+
+}
@@ -0,0 +1,328 @@
+#include "shm_ring.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <nncc/common/platform.h>
+
+#if NNCC_PLATFORM_LINUX
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#elif NNCC_PLATFORM_OSX
+// The futex of Darwin, which libc++ waits on atomics with as well. Not in the SDK headers.
+extern "C" int __ulock_wait(uint32_t operation, void* address, uint64_t value, uint32_t timeout_us);
+extern "C" int __ulock_wake(uint32_t operation, void* address, uint64_t wake_value);
+#endif
+
+namespace nncc::python {
+
+namespace {
+
+constexpr uint32_t kRingMagic = 0x52434e4e;  // "NNCR"
+constexpr uint32_t kRingVersion = 3;
+constexpr size_t kSlotsOffset = 256;
+
+#if NNCC_PLATFORM_OSX
+// UL_COMPARE_AND_WAIT_SHARED and ULF_WAKE_ALL of xnu's sys/ulock.h: the word is shared with another process
+constexpr uint32_t kUlockCompareAndWaitShared = 3;
+constexpr uint32_t kUlockWakeAll = 0x100;
+#elif !NNCC_PLATFORM_LINUX
+// Longest sleep between polls of a word, so that an idle wait costs next to nothing
+constexpr std::chrono::microseconds kMaxPollInterval(2000);
+#endif
+
+size_t SegmentSize(uint32_t capacity) {
+    return kSlotsOffset + static_cast<size_t>(capacity) * sizeof(SharedTensorDescriptor) +
+           kSharedTensorSnapshots * sizeof(SharedTensorSnapshot);
+}
+
+// Updates arriving back to back are picked up without a syscall on either side
+constexpr auto kSpinTime = std::chrono::microseconds(20);
+
+// Upper bound for a single sleep. A producer without a full fence, like the Python one, may miss a consumer that is
+// just going to sleep, in which case its update is picked up after this long instead of being lost.
+constexpr auto kMaxSleep = std::chrono::milliseconds(2);
+
+void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+}
+
+// Offsets are part of the protocol, see pynncc.py
+struct SharedTensorRing::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;
+    uint32_t snapshot_count;
+
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // Futex word, bumped by the producer before waking the consumer
+    alignas(64) std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> consumer_waiting;
+    std::atomic<uint32_t> stopped;
+};
+
+std::unique_ptr<SharedTensorRing> SharedTensorRing::Create(const nncc::string& name, uint32_t capacity) {
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+    static_assert(offsetof(Header, head) == 64 && offsetof(Header, tail) == 128 && offsetof(Header, sequence) == 192);
+    static_assert(offsetof(Header, consumer_waiting) == 196 && offsetof(Header, stopped) == 200);
+    static_assert(sizeof(Header) <= kSlotsOffset);
+    static_assert(offsetof(SharedTensorSnapshot, current) == 8 && offsetof(SharedTensorSnapshot, sequence) == 12);
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    const auto size = SegmentSize(capacity);
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    // The snapshots are zero as the segment is new
+    auto* header = new(memory) Header{kRingMagic, kRingVersion, capacity, sizeof(SharedTensorDescriptor),
+                                      kSharedTensorSnapshots};
+    header->head.store(0);
+    header->tail.store(0);
+    header->sequence.store(0);
+    header->consumer_waiting.store(0);
+    header->stopped.store(0);
+
+    return std::unique_ptr<SharedTensorRing>(new SharedTensorRing(name, memory, size, true));
+}
+
+std::unique_ptr<SharedTensorRing> SharedTensorRing::Open(const nncc::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info{};
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= kSlotsOffset) {
+        memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const auto size = static_cast<size_t>(info.st_size);
+    const auto* header = static_cast<const Header*>(memory);
+    if (header->magic != kRingMagic || header->version != kRingVersion ||
+        header->slot_size != sizeof(SharedTensorDescriptor) || header->snapshot_count != kSharedTensorSnapshots ||
+        SegmentSize(header->capacity) > size) {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    return std::unique_ptr<SharedTensorRing>(new SharedTensorRing(name, memory, size, false));
+}
+
+SharedTensorRing::SharedTensorRing(nncc::string name, void* memory, size_t size, bool owner)
+        : name_(std::move(name)), memory_(memory), size_(size), owner_(owner), header_(static_cast<Header*>(memory)) {}
+
+SharedTensorRing::~SharedTensorRing() {
+    munmap(memory_, size_);
+    if (owner_) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+SharedTensorDescriptor* SharedTensorRing::Slot(uint64_t index) const {
+    auto* slots = static_cast<uint8_t*>(memory_) + kSlotsOffset;
+    return reinterpret_cast<SharedTensorDescriptor*>(slots) + index % header_->capacity;
+}
+
+SharedTensorSnapshot* SharedTensorRing::Snapshots() const {
+    auto* slots = static_cast<uint8_t*>(memory_) + kSlotsOffset;
+    return reinterpret_cast<SharedTensorSnapshot*>(slots + header_->capacity * sizeof(SharedTensorDescriptor));
+}
+
+void SharedTensorRing::BeginSnapshotWrite(uint8_t snapshot, uint8_t buffer) {
+    auto& sequence = Snapshots()[snapshot].sequence[buffer % kSharedTensorMaxBuffers];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // Keeps the writes of the tensor after the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedTensorRing::EndSnapshotWrite(uint8_t snapshot, uint8_t buffer, uint64_t generation) {
+    auto& state = Snapshots()[snapshot];
+    auto& sequence = state.sequence[buffer % kSharedTensorMaxBuffers];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    state.current.store(buffer, std::memory_order_relaxed);
+    state.generation.store(generation, std::memory_order_release);
+}
+
+const SharedTensorSnapshot& SharedTensorRing::Snapshot(uint8_t snapshot) const {
+    return Snapshots()[snapshot];
+}
+
+std::optional<uint32_t> BeginSnapshotRead(const std::atomic<uint32_t>& sequence) {
+    const auto begin = sequence.load(std::memory_order_acquire);
+    if (begin % 2 != 0) {
+        return std::nullopt;
+    }
+    return begin;
+}
+
+bool EndSnapshotRead(const std::atomic<uint32_t>& sequence, uint32_t begin) {
+    // Keeps the reads of the tensor before the second look at the sequence
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sequence.load(std::memory_order_relaxed) == begin;
+}
+
+bool SharedTensorRing::TryPush(const SharedTensorDescriptor& descriptor) {
+    return TryPush(&descriptor, 1);
+}
+
+bool SharedTensorRing::TryPush(const SharedTensorDescriptor* descriptors, size_t count) {
+    const auto head = header_->head.load(std::memory_order_relaxed);
+    if (head + count - header_->tail.load(std::memory_order_acquire) > header_->capacity) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(Slot(head + i), descriptors + i, sizeof(SharedTensorDescriptor));
+    }
+    header_->head.store(head + count, std::memory_order_release);
+
+    // Orders the head store before reading the flag, pairing with the fence in Pop
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->consumer_waiting.load(std::memory_order_relaxed) != 0) {
+        Wake();
+    }
+    return true;
+}
+
+bool SharedTensorRing::TryPop(SharedTensorDescriptor* descriptor) {
+    const auto tail = header_->tail.load(std::memory_order_relaxed);
+    if (tail == header_->head.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    std::memcpy(descriptor, Slot(tail), sizeof(*descriptor));
+    header_->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool SharedTensorRing::Pop(SharedTensorDescriptor* descriptor, std::chrono::microseconds timeout) {
+    // Spinning only delays the producer when both share a single core
+    static const bool spin = std::thread::hardware_concurrency() > 1;
+    const auto start = std::chrono::steady_clock::now();
+    const auto spin_time = spin ? std::min<std::chrono::microseconds>(kSpinTime, timeout) : std::chrono::microseconds(0);
+    for (uint32_t i = 1; ; ++i) {
+        if (TryPop(descriptor)) {
+            return true;
+        }
+        if (i % 64 == 0 && std::chrono::steady_clock::now() - start >= spin_time) {
+            break;
+        }
+        CpuRelax();
+    }
+
+    const auto deadline = start + timeout;
+    while (!IsStopped()) {
+        const auto sequence = header_->sequence.load(std::memory_order_acquire);
+        header_->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (TryPop(descriptor)) {
+            header_->consumer_waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            header_->consumer_waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        Wait(sequence, std::min<std::chrono::microseconds>(
+                std::chrono::duration_cast<std::chrono::microseconds>(deadline - now), kMaxSleep));
+        header_->consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+uint32_t SharedTensorRing::Capacity() const {
+    return header_->capacity;
+}
+
+void SharedTensorRing::Stop() {
+    header_->stopped.store(1, std::memory_order_release);
+    Wake();
+}
+
+bool SharedTensorRing::IsStopped() const {
+    return header_->stopped.load(std::memory_order_acquire) != 0;
+}
+
+void SharedTensorRing::Wait(uint32_t sequence, std::chrono::microseconds timeout) {
+    WaitOnSharedWord(header_->sequence, sequence, timeout);
+}
+
+void SharedTensorRing::Wake() {
+    WakeSharedWord(header_->sequence);
+}
+
+void WaitOnSharedWord(const std::atomic<uint32_t>& word, uint32_t value, std::chrono::microseconds timeout) {
+#if NNCC_PLATFORM_LINUX
+    // Not FUTEX_PRIVATE_FLAG: the word is shared with another process
+    timespec duration{static_cast<time_t>(timeout.count() / 1000000),
+                      static_cast<long>(timeout.count() % 1000000) * 1000};
+    syscall(SYS_futex, &word, FUTEX_WAIT, value, &duration, nullptr, 0);
+#elif NNCC_PLATFORM_OSX
+    // A timeout of 0 would wait forever
+    if (timeout.count() <= 0) {
+        return;
+    }
+    __ulock_wait(kUlockCompareAndWaitShared, const_cast<std::atomic<uint32_t>*>(&word), value,
+                 static_cast<uint32_t>(std::min<int64_t>(timeout.count(), UINT32_MAX)));
+#else
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto interval = std::chrono::microseconds(50);
+    while (word.load(std::memory_order_acquire) == value) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+        interval = std::min(interval * 2, kMaxPollInterval);
+    }
+#endif
+}
+
+void WakeSharedWord(std::atomic<uint32_t>& word) {
+    word.fetch_add(1, std::memory_order_release);
+#if NNCC_PLATFORM_LINUX
+    syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#elif NNCC_PLATFORM_OSX
+    __ulock_wake(kUlockCompareAndWaitShared | kUlockWakeAll, &word, 0);
+#endif
+}
+
+}
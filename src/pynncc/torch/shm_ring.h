@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include <nncc/common/types.h>
+
+namespace nncc::python {
+
+constexpr size_t kSharedTensorMaxDims = 8;
+constexpr size_t kSharedTensorMaxRegions = 8;
+constexpr size_t kSharedTensorMaxBuffers = 4;
+constexpr size_t kSharedTensorSnapshots = 256;
+
+enum class SharedTensorUpdateKind : uint8_t {
+    Plain,
+    // The producer writes the tensor into one of several storages, versioned by a SharedTensorSnapshot
+    Snapshot
+};
+
+// Pixels of an image tensor, x along dims[1] and y along dims[0]
+struct SharedTensorRegion {
+    uint16_t x = 0, y = 0, width = 0, height = 0;
+};
+
+// Fixed-size binary update of a shared tensor, mirrored by SharedTensorRing in pynncc.py. Strings are zero-terminated
+// unless they fill their field. dtype holds a compute::DType. Without regions, the app finds out itself which parts
+// of an image changed. The first descriptor of a batch, which is published as a whole, holds the batch size. Snapshot
+// updates name the snapshot of the ring and the storage they wrote, whose handle they carry.
+struct SharedTensorDescriptor {
+    uint8_t kind = 0;
+    uint8_t dtype = 0;
+    uint8_t ndim = 0;
+    uint8_t region_count = 0;
+    uint16_t batch_size = 0;
+    uint8_t snapshot = 0;
+    uint8_t buffer = 0;
+    int64_t dims[kSharedTensorMaxDims]{};
+    char name[64]{};
+    char manager_handle[64]{};
+    char filename[56]{};
+    SharedTensorRegion regions[kSharedTensorMaxRegions]{};
+};
+
+static_assert(sizeof(SharedTensorDescriptor) == 320);
+
+// Versions of a tensor the producer writes into up to kSharedTensorMaxBuffers storages in turn, so that the app can
+// keep reading one while the next is written. Each storage is guarded by a seqlock: its sequence is odd while the
+// producer writes it, and a read is consistent if the sequence was even and did not change meanwhile.
+struct SharedTensorSnapshot {
+    // Of the last completed write, which went to storage `current`
+    std::atomic<uint64_t> generation;
+    std::atomic<uint32_t> current;
+    std::atomic<uint32_t> sequence[kSharedTensorMaxBuffers];
+    uint8_t reserved[36];
+};
+
+static_assert(sizeof(SharedTensorSnapshot) == 64);
+
+// Seqlock read side: the sequence to validate a read against, or nullopt while the storage is being written
+std::optional<uint32_t> BeginSnapshotRead(const std::atomic<uint32_t>& sequence);
+
+bool EndSnapshotRead(const std::atomic<uint32_t>& sequence, uint32_t begin);
+
+// Sleeps while a word shared with another process holds `value`, at most for the timeout. A futex on Linux, a ulock
+// on macOS, polling with a backoff of up to 2 ms elsewhere.
+void WaitOnSharedWord(const std::atomic<uint32_t>& word, uint32_t value, std::chrono::microseconds timeout);
+
+// Bumps the word and wakes everyone waiting on it
+void WakeSharedWord(std::atomic<uint32_t>& word);
+
+// Single-producer, single-consumer queue of descriptors in a POSIX shared memory segment. Head and tail are monotonic
+// counters written by the producer and the consumer respectively, so neither side ever takes a lock. A consumer that
+// ran out of descriptors spins briefly, then sleeps on a futex on Linux (polls elsewhere); the producer only makes
+// the wake-up syscall when the consumer announced that it sleeps. The segment also holds kSharedTensorSnapshots
+// snapshots after the descriptors, zero until the producer uses them.
+class SharedTensorRing {
+public:
+    // Consumer side: replaces any segment left over under this name, and removes it on destruction
+    static std::unique_ptr<SharedTensorRing> Create(const nncc::string& name, uint32_t capacity = 256);
+
+    // Producer side, or anyone who wants to stop the consumer. Null if the consumer has not created the ring yet.
+    static std::unique_ptr<SharedTensorRing> Open(const nncc::string& name);
+
+    ~SharedTensorRing();
+
+    SharedTensorRing(const SharedTensorRing&) = delete;
+
+    void operator=(const SharedTensorRing&) = delete;
+
+    // False if the ring is full
+    bool TryPush(const SharedTensorDescriptor& descriptor);
+
+    // All or nothing: the consumer sees either none or all of the descriptors, and is woken up at most once. False if
+    // the ring does not have room for all of them.
+    bool TryPush(const SharedTensorDescriptor* descriptors, size_t count);
+
+    [[nodiscard]] uint32_t Capacity() const;
+
+    // Producer side of snapshot writes
+    void BeginSnapshotWrite(uint8_t snapshot, uint8_t buffer);
+
+    void EndSnapshotWrite(uint8_t snapshot, uint8_t buffer, uint64_t generation);
+
+    [[nodiscard]] const SharedTensorSnapshot& Snapshot(uint8_t snapshot) const;
+
+    bool TryPop(SharedTensorDescriptor* descriptor);
+
+    // Waits for a descriptor until the timeout passes or the ring is stopped
+    bool Pop(SharedTensorDescriptor* descriptor, std::chrono::microseconds timeout);
+
+    // Makes a consumer blocked in Pop return
+    void Stop();
+
+    [[nodiscard]] bool IsStopped() const;
+
+private:
+    struct Header;
+
+    SharedTensorRing(nncc::string name, void* memory, size_t size, bool owner);
+
+    [[nodiscard]] SharedTensorDescriptor* Slot(uint64_t index) const;
+
+    [[nodiscard]] SharedTensorSnapshot* Snapshots() const;
+
+    void Wait(uint32_t sequence, std::chrono::microseconds timeout);
+
+    void Wake();
+
+    nncc::string name_;
+    void* memory_;
+    size_t size_;
+    bool owner_;
+    Header* header_;
+};
+
+}
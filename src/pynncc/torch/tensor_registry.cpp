@@ -1,4 +1,5 @@
 #include "tensor_registry.h"
+#include "shm_communication.h"
 
 #include <libshm/libshm.h>
 #include <torch/torch.h>
@@ -24,15 +25,145 @@
 
 namespace nncc::python {
 
-bgfx::TextureFormat::Enum GetTextureFormatFromChannelsAndDtype(int64_t channels, const torch::Dtype& dtype) {
+namespace {
+
+bgfx::TextureFormat::Enum GetNativeTextureFormat(int64_t channels, const torch::Dtype& dtype) {
     if (channels == 3 && dtype == torch::kUInt8) {
         return bgfx::TextureFormat::RGB8;
-    } else if (channels == 4 && dtype == torch::kFloat32) {
-        return bgfx::TextureFormat::RGBA32F;
     } else if (channels == 4 && dtype == torch::kUInt8) {
         return bgfx::TextureFormat::RGBA8;
+    } else if (channels == 4 && dtype == torch::kFloat16) {
+        return bgfx::TextureFormat::RGBA16F;
+    } else if (channels == 4 && dtype == torch::kFloat32) {
+        return bgfx::TextureFormat::RGBA32F;
+    }
+    return bgfx::TextureFormat::Unknown;
+}
+
+// Regions the producer names are in pixels of the image, a texture of elements lays them out differently
+nncc::vector<rendering::TextureRegion> ToTextureRegions(const TensorImage& image,
+                                                        const nncc::vector<rendering::TextureRegion>& regions) {
+    if (image.native) {
+        return regions;
+    }
+    // Which image of a batch changed is not known, so the app compares the whole batch itself
+    if (image.batch > 1) {
+        return {};
+    }
+
+    nncc::vector<rendering::TextureRegion> texture_regions;
+    const auto channels = static_cast<uint16_t>(image.channels), height = static_cast<uint16_t>(image.height);
+    for (const auto& region: regions) {
+        if (!image.planar) {
+            texture_regions.push_back({static_cast<uint16_t>(region.x * channels), region.y,
+                                       static_cast<uint16_t>(region.width * channels), region.height});
+            continue;
+        }
+        for (uint16_t channel = 0; channel < channels; ++channel) {
+            texture_regions.push_back({region.x, static_cast<uint16_t>(region.y + channel * height), region.width,
+                                       region.height});
+        }
+    }
+    return texture_regions;
+}
+
+}
+
+TensorImage DescribeTensorImage(const vector<int64_t>& dims, const torch::Dtype& dtype) {
+    const auto is_channels = [](int64_t size) {
+        return size >= 1 && size <= 4;
+    };
+
+    TensorImage image;
+    if (dims.size() == 2) {
+        image.height = dims[0];
+        image.width = dims[1];
+    } else if (dims.size() == 3 && is_channels(dims[2])) {
+        image.height = dims[0];
+        image.width = dims[1];
+        image.channels = dims[2];
+    } else if (dims.size() == 3 && is_channels(dims[0])) {
+        image.channels = dims[0];
+        image.height = dims[1];
+        image.width = dims[2];
+        image.planar = true;
+    } else if (dims.size() == 4 && is_channels(dims[3])) {
+        image.batch = dims[0];
+        image.height = dims[1];
+        image.width = dims[2];
+        image.channels = dims[3];
+    } else if (dims.size() == 4 && is_channels(dims[1])) {
+        image.batch = dims[0];
+        image.channels = dims[1];
+        image.height = dims[2];
+        image.width = dims[3];
+        image.planar = true;
+    } else {
+        throw std::runtime_error("Can only visualise HW, HWC, CHW, NHWC or NCHW tensors with up to 4 channels.");
+    }
+    if (image.batch < 1 || image.height < 1 || image.width < 1) {
+        throw std::runtime_error("Can not visualise an empty tensor.");
+    }
+
+    const auto native_format = image.batch == 1 && !image.planar ? GetNativeTextureFormat(image.channels, dtype)
+                                                                  : bgfx::TextureFormat::Unknown;
+    int64_t texture_width, texture_height;
+    if (native_format != bgfx::TextureFormat::Unknown) {
+        image.native = true;
+        image.format = native_format;
+        image.program = "default_diffuse";
+        texture_width = image.width;
+        texture_height = image.height;
+    } else {
+        if (dtype == torch::kUInt8) {
+            image.format = bgfx::TextureFormat::R8;
+            image.program = "tensor_float";
+        } else if (dtype == torch::kFloat16) {
+            image.format = bgfx::TextureFormat::R16F;
+            image.program = "tensor_float";
+        } else if (dtype == torch::kFloat32) {
+            image.format = bgfx::TextureFormat::R32F;
+            image.program = "tensor_float";
+        } else if (dtype == torch::kBFloat16) {
+            image.format = bgfx::TextureFormat::R16U;
+            image.program = "tensor_bfloat16";
+        } else if (dtype == torch::kInt32) {
+            image.format = bgfx::TextureFormat::R32I;
+            image.program = "tensor_labels";
+        } else {
+            throw std::runtime_error("Can only visualise uint8, int32, float16, bfloat16 or float32 tensors.");
+        }
+
+        while (image.columns * image.columns < image.batch) {
+            ++image.columns;
+        }
+        texture_width = image.planar ? image.width : image.width * image.channels;
+        texture_height = image.batch * image.height * (image.planar ? image.channels : 1);
+    }
+
+    const int64_t max_size = bgfx::getCaps()->limits.maxTextureSize;
+    if (texture_width > max_size || texture_height > max_size) {
+        throw std::runtime_error(fmt::format("Tensor needs a texture of {}x{}, larger than the maximum of {}.",
+                                             texture_width, texture_height, max_size));
+    }
+    image.texture_width = static_cast<uint16_t>(texture_width);
+    image.texture_height = static_cast<uint16_t>(texture_height);
+    return image;
+}
+
+compute::DType ToComputeDType(const torch::Dtype& dtype) {
+    if (dtype == torch::kUInt8) {
+        return compute::DType::UInt8;
+    } else if (dtype == torch::kInt32) {
+        return compute::DType::Int32;
+    } else if (dtype == torch::kFloat16) {
+        return compute::DType::Float16;
+    } else if (dtype == torch::kBFloat16) {
+        return compute::DType::BFloat16;
+    } else if (dtype == torch::kFloat32) {
+        return compute::DType::Float32;
     } else {
-        throw std::runtime_error("Can only visualise uint8 or float32 tensors with 3 or 4 channels (RGB or RGBA).");
+        throw std::runtime_error("Unsupported tensor dtype for the compute graph.");
     }
 }
 
@@ -99,11 +230,46 @@ void TensorRegistry::OnSharedTensorUpdate(const SharedTensorEvent& event) {
     auto& context = *context::Context::Get();
     auto& registry = context.registry;
 
+    // Of a snapshot update, the version it names is skipped if a later one was written since, which is on its way
+    const SharedTensorSnapshot* snapshot = nullptr;
+    uint64_t generation = 0;
+    if (event.ring) {
+        snapshot = &event.ring->Snapshot(event.snapshot);
+        generation = snapshot->generation.load(std::memory_order_acquire);
+        if (snapshot->current.load(std::memory_order_relaxed) != event.buffer) {
+            return;
+        }
+        if (auto found = tensors_.find(event.name); found != tensors_.end()) {
+            const auto* version = registry.try_get<SharedTensorVersion>(found->second);
+            if (version != nullptr && version->ring == event.ring && version->generation == generation) {
+                return;
+            }
+        }
+    }
+
+    // Described before anything is torn down, a layout that cannot be shown leaves the tensor without a picture
+    std::optional<TensorImage> image;
+    if (event.dims.size() >= 2 && event.dims.size() <= 4) {
+        try {
+            image = DescribeTensorImage(event.dims, event.dtype);
+        } catch (const std::runtime_error& error) {
+            context.log_message = fmt::format("{}: {}", event.name, error.what());
+        }
+    }
+
+    // A snapshot tensor leaves all but the storage it shows idle, as many as kSharedTensorMaxBuffers - 1. They come
+    // back in turn, so they stay mapped however many tensors are streamed.
+    if (snapshot != nullptr) {
+        const auto snapshot_tensors = registry.view<SharedTensorVersion>().size() + 1;
+        mappings_.Reserve(snapshot_tensors * (kSharedTensorMaxBuffers - 1));
+    }
+
     entt::entity entity;
     if (!tensors_.contains(event.name)) {
         context.log_message = fmt::format("CPU tensor: {}. {}, {}", event.name, event.manager_handle, event.filename);
         entity = registry.create();
-        registry.emplace<TensorWithPointer>(entity, event.manager_handle, event.filename, event.dtype, event.dims);
+        registry.emplace<TensorWithPointer>(entity, &mappings_, event.manager_handle, event.filename, event.dtype,
+                                            event.dims);
         registry.emplace<Name>(entity, event.name);
 
         tensors_[event.name] = entity;
@@ -113,9 +279,41 @@ void TensorRegistry::OnSharedTensorUpdate(const SharedTensorEvent& event) {
 
     } else {
         entity = tensors_.at(event.name);
+
+        // The producer replaced the storage behind the name: swap the tensor in place, keeping the entity
+        const auto& current = registry.get<TensorWithPointer>(entity);
+        if (!current.Matches(event)) {
+            const bool same_layout = (*current).scalar_type() == event.dtype &&
+                                     (*current).sizes() == at::IntArrayRef(event.dims.data(), event.dims.size());
+            registry.replace<TensorWithPointer>(entity, &mappings_, event.manager_handle, event.filename, event.dtype,
+                                                event.dims);
+
+            // A texture of another size or format is recreated below
+            if (!same_layout && registry.all_of<rendering::Material>(entity)) {
+                DestroyMaterial(entity);
+            }
+            if (!same_layout) {
+                registry.remove<UploadedPixels>(entity);
+            }
+        }
+    }
+
+    if (snapshot != nullptr) {
+        registry.emplace_or_replace<SharedTensorVersion>(entity, event.ring, generation);
+    } else {
+        registry.remove<SharedTensorVersion>(entity);
+    }
+
+    if (event.dims.size() >= 2 && event.dims.size() <= 4 && !image) {
+        if (registry.all_of<rendering::Material>(entity)) {
+            DestroyMaterial(entity);
+        }
+        registry.remove<rendering::Mesh, TensorImage, UploadedPixels>(entity);
+        drawable_.erase(entity);
+        return;
     }
 
-    if (event.dims.size() == 3) {
+    if (image) {
         if (!registry.all_of<rendering::Mesh>(entity)) {
             registry.emplace<rendering::Mesh>(entity, rendering::GetPlaneMesh());
 
@@ -125,39 +323,94 @@ void TensorRegistry::OnSharedTensorUpdate(const SharedTensorEvent& event) {
             bx::mtxMul(*transform, *identity, *x_translation);
 
             auto scale = identity;
-            bx::mtxScale(*scale, static_cast<float>(event.dims[1]) / static_cast<float>(event.dims[0]), 1.0f, 1.0f);
+            bx::mtxScale(*scale, image->Aspect(), 1.0f, 1.0f);
             bx::mtxMul(*transform, *transform, *scale);
+        } else if (const auto* previous = registry.try_get<TensorImage>(entity);
+                   previous != nullptr && previous->Aspect() != image->Aspect()) {
+            // The plane keeps its place, only its width follows the new layout
+            auto& transform = registry.get<math::Transform>(entity);
+            auto scale = math::Matrix4::Identity();
+            bx::mtxScale(*scale, image->Aspect() / previous->Aspect(), 1.0f, 1.0f);
+            bx::mtxMul(*transform, *scale, *transform);
         }
+        registry.emplace_or_replace<TensorImage>(entity, *image);
 
         // TODO: texture resource https://github.com/skypjack/entt/wiki/Crash-Course:-resource-management
         rendering::Material* material;
         if (!registry.all_of<rendering::Material>(entity)) {
             auto& _material = registry.emplace<rendering::Material>(entity);
-            _material.shader = context.rendering.shader_programs_["default_diffuse"];
-            auto height = event.dims[0], width = event.dims[1], channels = event.dims[2];
-            auto texture_format = GetTextureFormatFromChannelsAndDtype(channels, event.dtype);
-            _material.diffuse_texture = bgfx::createTexture2D(width, height, false, 0, texture_format, 0);
+            _material.shader = context.rendering.shader_programs_[image->program];
+            _material.diffuse_texture = bgfx::createTexture2D(image->texture_width, image->texture_height, false, 0,
+                                                              image->format,
+                                                              image->native ? 0 : BGFX_SAMPLER_POINT);
             _material.d_texture_uniform = bgfx::createUniform("diffuseTX", bgfx::UniformType::Sampler, 1);
             _material.d_color_uniform = bgfx::createUniform("diffuseCol", bgfx::UniformType::Vec4, 1);
+
+            // See shaders/tensor_image/tensor_image.sh
+            if (!image->native) {
+                const bool colormap = image->channels == 1 && event.dtype != torch::kUInt8;
+                _material.parameter_count = 3;
+                _material.parameter_uniforms = {
+                        bgfx::createUniform("tensorShape", bgfx::UniformType::Vec4, 1),
+                        bgfx::createUniform("tensorLayout", bgfx::UniformType::Vec4, 1),
+                        bgfx::createUniform("tensorRange", bgfx::UniformType::Vec4, 1),
+                };
+                _material.parameters[0] = {static_cast<float>(image->width), static_cast<float>(image->height),
+                                           static_cast<float>(image->channels), static_cast<float>(image->batch)};
+                _material.parameters[1] = {image->planar ? 1.0f : 0.0f, static_cast<float>(image->columns),
+                                           colormap ? 1.0f : 0.0f, 0.0f};
+                _material.parameters[2] = {1.0f, 0.0f, 0.0f, 0.0f};
+            }
             material = &_material;
 
         } else {
             material = &registry.get<rendering::Material>(entity);
         }
 
-        auto& tensor = *registry.get<TensorWithPointer>(entity);
-        auto texture_memory = bgfx::makeRef(tensor.data_ptr(), tensor.storage().nbytes());
-        bgfx::updateTexture2D(material->diffuse_texture,
-                              0,
-                              0,
-                              0,
-                              0,
-                              tensor.size(1),
-                              tensor.size(0),
-                              texture_memory);
-
         drawable_.insert(entity);
 
+        const auto& shared = registry.get<TensorWithPointer>(entity);
+        const auto& tensor = *shared;
+        const auto width = image->texture_width, height = image->texture_height;
+        const auto* pixels = static_cast<const uint8_t*>(tensor.data_ptr());
+
+        // A snapshot storage may be written again while it is read here, which its sequence tells
+        const std::atomic<uint32_t>* sequence = snapshot != nullptr ? &snapshot->sequence[event.buffer] : nullptr;
+        const auto begin = sequence != nullptr ? BeginSnapshotRead(*sequence) : std::optional<uint32_t>(0);
+
+        // Only the regions that changed are uploaded: the ones the producer names, or else those that differ from
+        // the pixels uploaded last time. Naming regions invalidates those pixels, which are not kept up to date then.
+        // Large images are not compared, the comparison and the copy kept would cost more than the upload saves.
+        auto regions = ToTextureRegions(*image, event.regions);
+        if (!regions.empty() || tensor.nbytes() > kMaxDiffedImageBytes) {
+            registry.remove<UploadedPixels>(entity);
+        } else if (auto* uploaded = registry.try_get<UploadedPixels>(entity)) {
+            regions = rendering::DiffTextureRegions(pixels, uploaded->value.data(), width, height,
+                                                    tensor.nbytes() / (static_cast<size_t>(width) * height));
+            if (regions.empty() && begin) {
+                return;
+            }
+        } else {
+            registry.emplace<UploadedPixels>(entity, nncc::vector<uint8_t>(pixels, pixels + tensor.nbytes()));
+        }
+
+        // Pixels compared or kept during a write may be a mix of two versions, the whole image is uploaded instead
+        if (sequence != nullptr && (!begin || !EndSnapshotRead(*sequence, *begin))) {
+            registry.remove<UploadedPixels>(entity);
+            regions.clear();
+        }
+
+        // Uploaded at the end of the frame, after any further updates of the same tensor. The producer keeps writing
+        // into the shared memory, so it is copied at that point rather than read by the render thread later.
+        std::shared_ptr<void> owner = shared.Mapping();
+        if (sequence != nullptr) {
+            // The sequence lives in the ring
+            owner = std::make_shared<std::pair<std::shared_ptr<void>, std::shared_ptr<const SharedTensorRing>>>(
+                    std::move(owner), event.ring);
+        }
+        uploader_.Request(material->diffuse_texture, width, height, pixels, tensor.nbytes(), std::move(owner), true,
+                          std::move(regions), sequence, upload_group_);
+
     } else if (event.dims.empty() || event.dims.size() == 1) {
         if (!registry.all_of<TensorControl>(entity)) {
             registry.emplace<TensorControl>(entity);
@@ -165,21 +418,23 @@ void TensorRegistry::OnSharedTensorUpdate(const SharedTensorEvent& event) {
     }
 }
 
+void TensorRegistry::OnSharedTensorBatch(const SharedTensorBatchEvent& event) {
+    // The textures of a batch are uploaded in the same frame or not at all
+    upload_group_ = ++last_upload_group_;
+    for (const auto& update: event.updates) {
+        OnSharedTensorUpdate(update);
+    }
+    upload_group_ = 0;
+}
+
 void TensorRegistry::OnSharedTensorControl(const TensorControlEvent& event) {
     if (!event.callback_name) {
         return;
     }
 
-    nncc::string queue_name = "nncc_requests";
-    nncc::string lock_name = fmt::format("nncc_{}", *event.callback_name);
-
-    auto do_update = redis_.get(lock_name.toStdString());
-    redis_.sync_commit();
-    auto reply = do_update.get();
-    if (reply.is_null() || reply.as_string() == "true") {
-        redis_.set(lock_name.toStdString(), "false");
-        redis_.lpush(queue_name.toStdString(), {event.callback_name->toStdString()});
-        redis_.sync_commit();
+    // Requests made while the producer still runs the callback are coalesced into one more call
+    if (!controls_ || !controls_->Request(*event.callback_name)) {
+        context::Context::Get()->log_message = fmt::format("Cannot request callback {}", *event.callback_name);
     }
 }
 
@@ -196,11 +451,15 @@ void TensorRegistry::Clear() {
 void TensorRegistry::Init(entt::dispatcher* dispatcher) {
     context::Context::Get()->subsystems.Register(this);
     dispatcher->sink<SharedTensorEvent>().connect<&TensorRegistry::OnSharedTensorUpdate>(*this);
+    dispatcher->sink<SharedTensorBatchEvent>().connect<&TensorRegistry::OnSharedTensorBatch>(*this);
     dispatcher->sink<TensorControlEvent>().connect<&TensorRegistry::OnSharedTensorControl>(*this);
-    redis_.connect();
+    controls_ = SharedControlMailbox::Create(kSharedControlMailboxName);
 }
 
 void TensorRegistry::OnTensorWithPointerDestroy(entt::registry& registry, entt::entity entity) {
+    if (registry.all_of<rendering::Material>(entity)) {
+        uploader_.Cancel(registry.get<rendering::Material>(entity).diffuse_texture);
+    }
     tensors_.erase(names_[entity]);
     names_.erase(entity);
     if (drawable_.contains(entity)) {
@@ -209,7 +468,20 @@ void TensorRegistry::OnTensorWithPointerDestroy(entt::registry& registry, entt::
 }
 
 void TensorRegistry::Update() {
-    redis_.commit();
+    uploader_.Flush();
+}
+
+void TensorRegistry::DestroyMaterial(entt::entity entity) {
+    auto& registry = context::Context::Get()->registry;
+    const auto& material = registry.get<rendering::Material>(entity);
+    uploader_.Cancel(material.diffuse_texture);
+    bgfx::destroy(material.diffuse_texture);
+    bgfx::destroy(material.d_texture_uniform);
+    bgfx::destroy(material.d_color_uniform);
+    for (uint8_t i = 0; i < material.parameter_count; ++i) {
+        bgfx::destroy(material.parameter_uniforms[i]);
+    }
+    registry.remove<rendering::Material>(entity);
 }
 
 entt::entity TensorRegistry::Get(const string& name) {
@@ -227,26 +499,63 @@ bool TensorRegistry::Contains(entt::entity entity) {
     return names_.contains(entity);
 }
 
-TensorWithPointer::TensorWithPointer(const string& manager_handle,
+SharedMemoryMappings::SharedMemoryMappings(size_t max_idle) : max_idle_(max_idle) {}
+
+std::shared_ptr<at::DataPtr> SharedMemoryMappings::Acquire(const string& manager_handle, const string& filename,
+                                                           size_t bytes) {
+    for (auto mapping = mappings_.begin(); mapping != mappings_.end(); ++mapping) {
+        if (mapping->manager_handle == manager_handle && mapping->filename == filename && mapping->bytes >= bytes) {
+            mappings_.splice(mappings_.begin(), mappings_, mapping);
+            return mapping->data;
+        }
+    }
+
+    auto data = std::make_shared<at::DataPtr>(THManagedMapAllocator::makeDataPtr(
+            manager_handle.c_str(),
+            filename.c_str(),
+            at::ALLOCATOR_MAPPED_SHAREDMEM,
+            bytes
+    ));
+    mappings_.push_front(Mapping{manager_handle, filename, bytes, data});
+    Trim();
+    return data;
+}
+
+void SharedMemoryMappings::Trim() {
+    // Only the cache refers to an idle mapping, dropping it there unmaps it
+    size_t idle = 0;
+    for (auto mapping = mappings_.begin(); mapping != mappings_.end();) {
+        if (mapping->data.use_count() == 1 && ++idle > max_idle_ + reserved_) {
+            mapping = mappings_.erase(mapping);
+        } else {
+            ++mapping;
+        }
+    }
+}
+
+TensorWithPointer::TensorWithPointer(SharedMemoryMappings* mappings,
+                                     const string& manager_handle,
                                      const string& filename,
                                      torch::Dtype dtype,
-                                     const vector<int64_t>& dims) {
+                                     const vector<int64_t>& dims)
+        : manager_handle_(manager_handle), filename_(filename) {
     size_t total_bytes = (
             torch::elementSize(dtype)
-            * std::accumulate(dims.begin(), dims.end(), 1, std::multiplies<>())
+            * std::accumulate(dims.begin(), dims.end(), size_t(1), std::multiplies<>())
     );
 
-    data_ptr_ = THManagedMapAllocator::makeDataPtr(
-            manager_handle.c_str(),
-            filename.c_str(),
-            at::ALLOCATOR_MAPPED_SHAREDMEM,
-            total_bytes
-    );
-    tensor_ = torch::from_blob(data_ptr_.get(),
+    mapping_ = mappings->Acquire(manager_handle, filename, total_bytes);
+    tensor_ = torch::from_blob(mapping_->get(),
                                at::IntArrayRef(dims.data(), dims.size()),
                                torch::TensorOptions().dtype(dtype));
 }
 
+bool TensorWithPointer::Matches(const SharedTensorEvent& event) const {
+    return manager_handle_ == event.manager_handle && filename_ == event.filename &&
+           tensor_.scalar_type() == event.dtype &&
+           tensor_.sizes() == at::IntArrayRef(event.dims.data(), event.dims.size());
+}
+
 const torch::Tensor& TensorWithPointer::operator*() const {
     return tensor_;
 }
@@ -255,6 +564,11 @@ torch::Tensor& TensorWithPointer::operator*() {
     return const_cast<torch::Tensor&>(const_cast<const TensorWithPointer*>(this)->operator*());
 }
 
+compute::TensorView TensorWithPointer::View() const {
+    auto sizes = tensor_.sizes();
+    return {ToComputeDType(tensor_.scalar_type()), sizes.data(), sizes.size(), mapping_->get(), mapping_};
+}
+
 Name::Name(const string& _value) : value(_value) {}
 
 SharedTensorPicker::SharedTensorPicker(TensorRegistry* tensors) : tensors_(*tensors) {
@@ -313,7 +627,10 @@ void SharedTensorPicker::Render() {
             if (selected_tensor_ != entt::null) {
                 if (auto material = registry.try_get<rendering::Material>(selected_tensor_)) {
                     material->diffuse_color = 0xDDFFDDFF;
-                    texture = material->diffuse_texture;
+                    // A texture of raw elements only makes sense through its shader
+                    if (auto image = registry.try_get<TensorImage>(selected_tensor_); image && image->native) {
+                        texture = material->diffuse_texture;
+                    }
                 }
             }
             ImGui::EndListBox();
@@ -1,13 +1,18 @@
 #pragma once
 
+#include <list>
+
 #include <bgfx/bgfx.h>
-#include <cpp_redis/cpp_redis>
 #include <entt/entt.hpp>
 #include <torch/torch.h>
 
 #include <nncc/common/types.h>
+#include <nncc/compute/tensor.h>
 #include <nncc/engine/camera.h>
 #include <nncc/gui/gui.h>
+#include <nncc/rendering/texture_uploader.h>
+#include <pynncc/torch/shm_control.h>
+#include <pynncc/torch/shm_ring.h>
 
 
 struct TensorControl {
@@ -25,12 +30,102 @@ struct RetrieveKey {
 
 namespace nncc::python {
 
-bgfx::TextureFormat::Enum GetTextureFormatFromChannelsAndDtype(int64_t channels, const torch::Dtype& dtype);
+// How an image tensor is shown. RGB and RGBA images the GPU can sample as they are get a texture of their pixels and
+// the default shader. Anything else is uploaded unchanged as a single-channel texture of its elements, which one of
+// the tensor_image shaders converts, transposes and colormaps while drawing. Batches are shown as a grid.
+struct TensorImage {
+    int64_t batch = 1, channels = 1, height = 0, width = 0;
+
+    // CHW or NCHW rather than HWC or NHWC
+    bool planar = false;
+
+    bool native = false;
+    bgfx::TextureFormat::Enum format = bgfx::TextureFormat::Unknown;
+    nncc::string program;
+    uint16_t texture_width = 0, texture_height = 0;
+    int64_t columns = 1;
+
+    [[nodiscard]] int64_t Rows() const {
+        return (batch + columns - 1) / columns;
+    }
+
+    // Width over height of what is shown, the whole grid for a batch
+    [[nodiscard]] float Aspect() const {
+        return static_cast<float>(width * columns) / static_cast<float>(height * Rows());
+    }
+};
+
+// HW, HWC, CHW, NHWC or NCHW with up to 4 channels, of uint8, int32 (label maps), float16, bfloat16 or float32.
+// Throws for anything else.
+TensorImage DescribeTensorImage(const nncc::vector<int64_t>& dims, const torch::Dtype& dtype);
+
+compute::DType ToComputeDType(const torch::Dtype& dtype);
+
+
+struct SharedTensorEvent {
+    nncc::string name;
+    nncc::string manager_handle;
+    nncc::string filename;
+    torch::Dtype dtype;
+    nncc::vector<int64_t> dims;
+
+    // Changed pixels of an image, unknown if empty
+    nncc::vector<rendering::TextureRegion> regions;
+
+    // Of snapshot updates: the ring holding the snapshot that versions the tensor, and the storage written
+    std::shared_ptr<const SharedTensorRing> ring;
+    uint8_t snapshot = 0, buffer = 0;
+};
+
+
+// Updates the producer published together, e.g. all tensors of a training step, applied within the same frame
+struct SharedTensorBatchEvent {
+    nncc::vector<SharedTensorEvent> updates;
+};
+
+
+// Shared memory mappings by (manager handle, file name). A producer updating a tensor in place keeps sending the same
+// handle, which then resolves to the existing mapping instead of another mmap. Mappings are reference counted by the
+// tensors and views using them; up to `max_idle` unused ones are kept, and the least recently used is unmapped first.
+// Main thread only.
+class SharedMemoryMappings {
+public:
+    explicit SharedMemoryMappings(size_t max_idle = 32);
+
+    std::shared_ptr<at::DataPtr> Acquire(const nncc::string& manager_handle, const nncc::string& filename,
+                                         size_t bytes);
+
+    // Keeps `idle` unused mappings on top of `max_idle`, e.g. the snapshot storages a producer writes in turn, which
+    // are idle between their turns
+    void Reserve(size_t idle) {
+        reserved_ = idle;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return mappings_.size();
+    }
+
+private:
+    struct Mapping {
+        nncc::string manager_handle, filename;
+        size_t bytes;
+        std::shared_ptr<at::DataPtr> data;
+    };
+
+    void Trim();
+
+    size_t max_idle_;
+    size_t reserved_ = 0;
+
+    // Most recently used first
+    std::list<Mapping> mappings_;
+};
 
 
 class TensorWithPointer {
 public:
     TensorWithPointer(
+            SharedMemoryMappings* mappings,
             const nncc::string& manager_handle,
             const nncc::string& filename,
             torch::Dtype dtype,
@@ -41,12 +136,40 @@ public:
 
     torch::Tensor& operator*();
 
+    // Zero-copy view for the compute graph, keeping the shared memory mapped for as long as it is alive
+    compute::TensorView View() const;
+
+    // Whether an update describes this very tensor, so that it can be reused as it is
+    bool Matches(const SharedTensorEvent& event) const;
+
+    // Keeps the shared memory mapped, e.g. until a texture upload has read it
+    [[nodiscard]] std::shared_ptr<void> Mapping() const {
+        return mapping_;
+    }
+
 private:
-    at::DataPtr data_ptr_{};
+    nncc::string manager_handle_, filename_;
+    std::shared_ptr<at::DataPtr> mapping_;
     torch::Tensor tensor_{};
 };
 
 
+// Generation of the snapshot last applied to a tensor, whose ring is kept open while the tensor exists
+struct SharedTensorVersion {
+    std::shared_ptr<const SharedTensorRing> ring;
+    uint64_t generation = 0;
+};
+
+
+// Pixels of an image tensor as last uploaded, to find out what changed when the producer does not tell. Only kept for
+// images of up to kMaxDiffedImageBytes, larger ones are uploaded whole.
+const size_t kMaxDiffedImageBytes = size_t(4) << 20;
+
+struct UploadedPixels {
+    nncc::vector<uint8_t> value;
+};
+
+
 struct Name {
     Name() = default;
 
@@ -61,14 +184,6 @@ struct TensorControlEvent {
     std::optional<nncc::string> callback_name;
 };
 
-struct SharedTensorEvent {
-    nncc::string name;
-    nncc::string manager_handle;
-    nncc::string filename;
-    torch::Dtype dtype;
-    nncc::vector<int64_t> dims;
-};
-
 
 class TensorRegistry {
 public:
@@ -80,6 +195,8 @@ public:
 
     void OnSharedTensorUpdate(const SharedTensorEvent& event);
 
+    void OnSharedTensorBatch(const SharedTensorBatchEvent& event);
+
     void OnSharedTensorControl(const TensorControlEvent& event);
 
     void Update();
@@ -92,12 +209,24 @@ public:
 
     void Clear();
 
+    rendering::TextureUploader& Uploader() {
+        return uploader_;
+    }
+
 private:
+    void DestroyMaterial(entt::entity entity);
+
     std::unordered_map<nncc::string, entt::entity> tensors_;
     std::unordered_set<entt::entity> drawable_;
     std::unordered_map<entt::entity, nncc::string> names_;
 
-    cpp_redis::client redis_;
+    SharedMemoryMappings mappings_;
+    rendering::TextureUploader uploader_;
+    // Of the batch being applied, 0 outside of one
+    uint64_t upload_group_ = 0, last_upload_group_ = 0;
+
+    // Asks the producer to run control callbacks
+    std::unique_ptr<SharedControlMailbox> controls_;
 };
 
 bool TensorControlGui(const nncc::string& label, entt::entity tensor_entity, const nncc::string& callback_name);